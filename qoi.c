@@ -21,13 +21,21 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <stdint.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <endian.h>
+#include <sys/mman.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "qoi.h"
 
 typedef unsigned char ubyte;
 typedef unsigned char vec4u8 __attribute__((vector_size(4))) __attribute__((aligned(4)));
+typedef unsigned char vec16u8 __attribute__((vector_size(16)));
+typedef uint64_t vec2u64 __attribute__((vector_size(16)));
 
 union Pixel{
     struct{
@@ -62,6 +70,20 @@ uint32_t header_get_h(struct qoi_header h){
     return be32toh(h.h);
 }
 
+/*
+ w * h * bytes_per_pixel, or 0 when that doesn't fit in a size_t. Every buffer size computed from a header goes through this,
+ a header with w = h = 0x80000000 would otherwise wrap around to a tiny size.
+ */
+static
+size_t image_size(uint64_t w, uint64_t h, size_t bytes_per_pixel){
+    size_t size;
+
+    if( w > SIZE_MAX || h > SIZE_MAX || __builtin_mul_overflow((size_t)w, (size_t)h, &size) || __builtin_mul_overflow(size, bytes_per_pixel, &size) ){
+        return 0;
+    }
+    return size;
+}
+
 static
 struct qoi_header write_header(ubyte *out, ubyte channels, size_t w, size_t h){
     struct qoi_header header = {
@@ -145,9 +167,307 @@ bool pixels_equal(const union Pixel *a, const union Pixel *b){
 }
 
 
+/*
+ Encoder and decoder state for the paths that can't run the whole image in one loop
+ (animation frames, checkpoints, ...). These produce the same output as the compress/decompress_image functions.
+ */
+struct encoder{
+    union Pixel pixels[64];
+    union Pixel prev_pixel;
+    ubyte run_length;
+};
+
+struct decoder{
+    union Pixel pixels[64];
+    union Pixel prev_pixel;
+};
+
+
+static
+void encoder_init(struct encoder *e){
+    memset(e->pixels, 0, sizeof(e->pixels));
+    e->prev_pixel = (union Pixel){{0, 0, 0, 255}};
+    e->run_length = 0;
+}
+
+
+static
+void decoder_init(struct decoder *d){
+    memset(d->pixels, 0, sizeof(d->pixels));
+    d->prev_pixel = (union Pixel){{0, 0, 0, 255}};
+}
+
+
+static inline
+union Pixel load_pixel(const ubyte *in, ubyte channels){
+    union Pixel p = {{0, 0, 0, 255}};
+    memcpy(&p, in, channels);
+    return p;
+}
+
+
+/*
+ RGB pixels are loaded and stored 16 at a time, shuffling the 48 bytes of RGB data from/to 64 bytes of RGBA pixels.
+ Reading 3 bytes into a 4 byte pixel one at a time stalls on the partial write when the pixel is read back.
+ */
+#define RGB_BLOCK 16
+
+static inline
+void expand_rgb_block(const ubyte *restrict in, union Pixel *restrict block){
+    const vec16u8 alpha = {0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255};
+    vec16u8 a, b, c, p[4];
+
+    memcpy(&a, &in[0], 16);
+    memcpy(&b, &in[16], 16);
+    memcpy(&c, &in[32], 16);
+
+    p[0] = __builtin_shuffle(a, (vec16u8){0, 1, 2, 0, 3, 4, 5, 0, 6, 7, 8, 0, 9, 10, 11, 0});
+    p[1] = __builtin_shuffle(a, b, (vec16u8){12, 13, 14, 0, 15, 16, 17, 0, 18, 19, 20, 0, 21, 22, 23, 0});
+    p[2] = __builtin_shuffle(b, c, (vec16u8){8, 9, 10, 0, 11, 12, 13, 0, 14, 15, 16, 0, 17, 18, 19, 0});
+    p[3] = __builtin_shuffle(c, (vec16u8){4, 5, 6, 0, 7, 8, 9, 0, 10, 11, 12, 0, 13, 14, 15, 0});
+
+    for( size_t i = 0; i < 4; i++ ){
+        p[i] = (p[i] & ~alpha) | alpha;
+    }
+    memcpy(block, p, sizeof(p));
+}
+
+
+static inline
+void pack_rgb_block(const union Pixel *restrict block, ubyte *restrict out){
+    vec16u8 p[4], a, b, c;
+
+    memcpy(p, block, sizeof(p));
+
+    a = __builtin_shuffle(p[0], p[1], (vec16u8){0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 16, 17, 18, 20});
+    b = __builtin_shuffle(p[1], p[2], (vec16u8){5, 6, 8, 9, 10, 12, 13, 14, 16, 17, 18, 20, 21, 22, 24, 25});
+    c = __builtin_shuffle(p[2], p[3], (vec16u8){10, 12, 13, 14, 16, 17, 18, 20, 21, 22, 24, 25, 26, 28, 29, 30});
+
+    memcpy(&out[0], &a, 16);
+    memcpy(&out[16], &b, 16);
+    memcpy(&out[32], &c, 16);
+}
+
+
+static inline
+size_t encode_flush(struct encoder *restrict e, ubyte *restrict out){
+    if( e->run_length > 0 ){
+        write_qoi_run(out, e->run_length);
+        e->run_length = 0;
+        return 1;
+    }
+    return 0;
+}
+
+
+static inline
+size_t encode_pixel(struct encoder *restrict e, ubyte *restrict out, union Pixel cur_pixel){
+    union Pixel true_diff;
+    union Pixel diff_pixel;
+    union Pixel luma_pixel;
+    ubyte pixels_index;
+    size_t out_pos;
+
+    if( pixels_equal(&cur_pixel, &e->prev_pixel) ){
+        e->run_length += 1;
+        if( e->run_length == 62 ){
+            return encode_flush(e, out);
+        }
+        return 0;
+    }
+
+    out_pos = encode_flush(e, out);
+    pixels_index = calculate_index(&cur_pixel);
+
+    if( pixels_equal(&cur_pixel, &e->pixels[pixels_index]) ){
+        write_qoi_index(&out[out_pos], pixels_index);
+    }
+    else if( cur_pixel.a == e->prev_pixel.a ){
+        true_diff.vec = cur_pixel.vec - e->prev_pixel.vec;
+        if( calculate_diff_true_diff(&diff_pixel, &true_diff) ){
+            write_qoi_diff(&out[out_pos], &diff_pixel);
+        }
+        else if( calculate_luma_true_diff(&luma_pixel, &true_diff) ){
+            write_qoi_luma(&out[out_pos], &luma_pixel);
+            out_pos += 1;
+        }
+        else{
+            out[out_pos] = QOI_OP_RGB;
+            memcpy(&out[out_pos+1], &cur_pixel, 3);
+            out_pos += 3;
+        }
+    }
+    else{
+        out[out_pos] = QOI_OP_RGBA;
+        memcpy(&out[out_pos+1], &cur_pixel, 4);
+        out_pos += 4;
+    }
+
+    e->pixels[pixels_index].i = cur_pixel.i;
+    e->prev_pixel.i = cur_pixel.i;
+    return out_pos + 1;
+}
+
+
+static
+size_t encode_pixels(struct encoder *restrict e, const ubyte *restrict in, size_t count, ubyte *restrict out, ubyte channels){
+    size_t out_pos = 0;
+
+    if( channels == 4 ){
+        for( size_t i = 0; i < count; i++ ){
+            out_pos += encode_pixel(e, &out[out_pos], load_pixel(&in[i * 4], 4));
+        }
+    }else{
+        union Pixel block[RGB_BLOCK];
+        size_t i = 0;
+
+        for( ; i + RGB_BLOCK <= count; i += RGB_BLOCK ){
+            expand_rgb_block(&in[i * 3], block);
+            for( size_t j = 0; j < RGB_BLOCK; j++ ){
+                out_pos += encode_pixel(e, &out[out_pos], block[j]);
+            }
+        }
+        for( ; i < count; i++ ){
+            out_pos += encode_pixel(e, &out[out_pos], load_pixel(&in[i * 3], 3));
+        }
+    }
+    return out_pos;
+}
+
+
+/*
+ Decodes a single op. The decoded pixel ends up in d->prev_pixel and has to be repeated run_length times.
+ Returns the amount of bytes read.
+ */
+static inline
+size_t decode_op(struct decoder *restrict d, const ubyte *restrict in, size_t *run_length){
+    const ubyte b = in[0];
+    union Pixel diff_pixel = {{0, 0, 0, 0}};
+    union Pixel cur_pixel = d->prev_pixel;
+    size_t in_size = 1;
+
+    *run_length = 1;
+
+    if( b == QOI_OP_RGB ){
+        memcpy(&cur_pixel, &in[1], 3);
+        in_size = 4;
+    }
+    else if( b == QOI_OP_RGBA ){
+        memcpy(&cur_pixel, &in[1], 4);
+        in_size = 5;
+    }
+    else if( (b & QOI_OP_RUN) == QOI_OP_RUN ){
+        *run_length = (b & 63) + 1;
+    }
+    else if( (b & QOI_OP_LUMA) == QOI_OP_LUMA ){
+        diff_pixel.g = (b & 63) - 32;
+        diff_pixel.r = ((in[1]>>4)& 0x0F) + diff_pixel.g - 8;
+        diff_pixel.b = (in[1] & 0x0F)     + diff_pixel.g - 8;
+        cur_pixel.vec += diff_pixel.vec;
+        in_size = 2;
+    }
+    else if( (b & QOI_OP_DIFF) == QOI_OP_DIFF ){
+        diff_pixel.r = (b>>4)&3;
+        diff_pixel.g = (b>>2)&3;
+        diff_pixel.b = b&3;
+        cur_pixel.vec += diff_pixel.vec + (vec4u8){-2, -2, -2, 0};
+    }
+    else{
+        cur_pixel.i = d->pixels[b].i;
+    }
+
+    d->pixels[calculate_index(&cur_pixel)].i = cur_pixel.i;
+    d->prev_pixel.i = cur_pixel.i;
+    return in_size;
+}
+
+
+/*
+ Decodes ops until at least `end` pixels are done. Runs are cut off at pixel_count.
+ Returns the new pixel counter, in_index is moved past the decoded ops.
+ */
+static inline
+size_t decode_pixels(struct decoder *restrict d, const ubyte *restrict in, size_t *in_index, ubyte *restrict out, size_t pixel_counter, size_t end, size_t pixel_count, ubyte channels){
+    size_t run_length;
+
+    while( pixel_counter < end ){
+        *in_index += decode_op(d, &in[*in_index], &run_length);
+        if( run_length > pixel_count - pixel_counter ){
+            run_length = pixel_count - pixel_counter;
+        }
+        while( run_length-- ){
+            memcpy(&out[pixel_counter * channels], &d->prev_pixel, channels);
+            pixel_counter += 1;
+        }
+    }
+    return pixel_counter;
+}
+
+
+static
+size_t write_varint(ubyte *out, size_t value){
+    size_t out_pos = 0;
+    while( value >= 0x80 ){
+        out[out_pos++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out[out_pos++] = value;
+    return out_pos;
+}
+
+
+static
+size_t read_varint(const ubyte *in, size_t *value){
+    size_t in_pos = 0;
+    unsigned int shift = 0;
+    *value = 0;
+    do{
+        if( shift >= sizeof(size_t) * 8 ){
+            return 0;
+        }
+        *value |= (size_t)(in[in_pos] & 0x7F) << shift;
+        shift += 7;
+    }while( in[in_pos++] & 0x80 );
+    return in_pos;
+}
+
+
+/*
+ Returns how many leading bytes of a and b are equal, comparing 64 bytes at a time.
+ */
+static
+size_t count_equal_bytes(const ubyte *a, const ubyte *b, size_t len){
+    size_t i = 0;
+    vec2u64 va[4], vb[4], x;
+
+    while( i + 64 <= len ){
+        memcpy(va, &a[i], 64);
+        memcpy(vb, &b[i], 64);
+        x = (va[0] ^ vb[0]) | (va[1] ^ vb[1]) | (va[2] ^ vb[2]) | (va[3] ^ vb[3]);
+        if( (x[0] | x[1]) != 0 ){
+            break;
+        }
+        i += 64;
+    }
+    while( i + 16 <= len ){
+        memcpy(va, &a[i], 16);
+        memcpy(vb, &b[i], 16);
+        x = va[0] ^ vb[0];
+        if( (x[0] | x[1]) != 0 ){
+            break;
+        }
+        i += 16;
+    }
+    while( i < len && a[i] == b[i] ){
+        i += 1;
+    }
+    return i;
+}
+
+
 static
 size_t compress_image_rgba(const ubyte* in, ubyte* out, struct qoi_header settings){
-    const size_t pixel_count = header_get_w(settings) * header_get_h(settings);
+    const size_t pixel_count = (size_t)header_get_w(settings) * header_get_h(settings);
 
     union Pixel pixels[64];
     union Pixel cur_pixel;
@@ -162,7 +482,6 @@ size_t compress_image_rgba(const ubyte* in, ubyte* out, struct qoi_header settin
     ubyte pixels_index;
 
     memset(pixels, 0, sizeof(pixels));
-    pixels[calculate_index(&prev_pixel)].i = prev_pixel.i;
 
     while(pixel_counter < pixel_count) {
         memcpy(&cur_pixel, &in[pixel_counter * 4], 4);
@@ -229,7 +548,7 @@ size_t compress_image_rgba(const ubyte* in, ubyte* out, struct qoi_header settin
 
 static
 size_t compress_image_rgb(const ubyte* in, ubyte* out, struct qoi_header settings){
-    const size_t pixel_count = header_get_w(settings) * header_get_h(settings);
+    const size_t pixel_count = (size_t)header_get_w(settings) * header_get_h(settings);
 
     union Pixel pixels[64];
     union Pixel prev_pixel = {{0, 0, 0, 255}};
@@ -238,7 +557,10 @@ size_t compress_image_rgb(const ubyte* in, ubyte* out, struct qoi_header setting
     union Pixel luma_pixel;
     union Pixel true_diff;
 
+    union Pixel block[RGB_BLOCK];
+
     size_t pixel_counter = 0;
+    size_t block_length;
     size_t out_pos = 0;
     ubyte run_length = 0;
     size_t pixels_index;
@@ -247,49 +569,60 @@ size_t compress_image_rgb(const ubyte* in, ubyte* out, struct qoi_header setting
 
     while(pixel_counter < pixel_count)
     {
-        memcpy(&cur_pixel, &in[pixel_counter * 3], 3);
-        if( pixels_equal(&cur_pixel, &prev_pixel) ){
-            run_length += 1;
-            if( run_length == 62 ){
-                write_qoi_run(&out[out_pos], run_length);
-                out_pos += 1;
-                run_length = 0;
-            }
-        }else
-        {
-            if( run_length > 0 ){
-                write_qoi_run(&out[out_pos], run_length);
-                out_pos += 1;
-                run_length = 0;
+        block_length = pixel_count - pixel_counter < RGB_BLOCK ? pixel_count - pixel_counter : RGB_BLOCK;
+        if( block_length == RGB_BLOCK ){
+            expand_rgb_block(&in[pixel_counter * 3], block);
+        }else{
+            for( size_t i = 0; i < block_length; i++ ){
+                block[i] = load_pixel(&in[(pixel_counter + i) * 3], 3);
             }
+        }
 
-            pixels_index = calculate_index(&cur_pixel);
-
-            if( cur_pixel.i == pixels[pixels_index].i ) {
-                write_qoi_index(&out[out_pos], (ubyte)pixels_index);
-                out_pos += 1;
-            }
-            else{
-                true_diff.vec = cur_pixel.vec - prev_pixel.vec;
-                if( calculate_diff_true_diff(&diff_pixel, &true_diff) ){
-                    write_qoi_diff(&out[out_pos], &diff_pixel);
+        for( size_t i = 0; i < block_length; i++ ){
+            cur_pixel.i = block[i].i;
+            if( pixels_equal(&cur_pixel, &prev_pixel) ){
+                run_length += 1;
+                if( run_length == 62 ){
+                    write_qoi_run(&out[out_pos], run_length);
                     out_pos += 1;
+                    run_length = 0;
                 }
-                else if( calculate_luma_true_diff(&luma_pixel, &true_diff) ){
-                    write_qoi_luma(&out[out_pos], &luma_pixel);
-                    out_pos += 2;
+            }else
+            {
+                if( run_length > 0 ){
+                    write_qoi_run(&out[out_pos], run_length);
+                    out_pos += 1;
+                    run_length = 0;
                 }
-                else {
-                    out[out_pos] = QOI_OP_RGB;
-                    memcpy(&out[out_pos+1], &cur_pixel, 3);
-                    out_pos += 4;
+
+                pixels_index = calculate_index(&cur_pixel);
+
+                if( cur_pixel.i == pixels[pixels_index].i ) {
+                    write_qoi_index(&out[out_pos], (ubyte)pixels_index);
+                    out_pos += 1;
+                }
+                else{
+                    true_diff.vec = cur_pixel.vec - prev_pixel.vec;
+                    if( calculate_diff_true_diff(&diff_pixel, &true_diff) ){
+                        write_qoi_diff(&out[out_pos], &diff_pixel);
+                        out_pos += 1;
+                    }
+                    else if( calculate_luma_true_diff(&luma_pixel, &true_diff) ){
+                        write_qoi_luma(&out[out_pos], &luma_pixel);
+                        out_pos += 2;
+                    }
+                    else {
+                        out[out_pos] = QOI_OP_RGB;
+                        memcpy(&out[out_pos+1], &cur_pixel, 3);
+                        out_pos += 4;
+                    }
                 }
+                prev_pixel.i = cur_pixel.i;
+                pixels[pixels_index].i = cur_pixel.i;
             }
-            prev_pixel.i = cur_pixel.i;
-            pixels[pixels_index].i = cur_pixel.i;
-        }
 
-        pixel_counter += 1;
+        }
+        pixel_counter += block_length;
     }
 
     if( run_length > 0 ){
@@ -306,15 +639,14 @@ size_t compress_image_rgb(const ubyte* in, ubyte* out, struct qoi_header setting
 
 
 static
-size_t decompress_image_rgba(const ubyte* in, ubyte* out, struct qoi_header header){
-    const size_t pixel_count = header.w * header.h;
+size_t decompress_image_rgba(const ubyte* in, ubyte* out, struct qoi_header header, size_t *in_size){
+    const size_t pixel_count = (size_t)header.w * header.h;
     size_t pixel_counter = 0;
 
     union Pixel pixels[64];
     union Pixel prev_pixel = {{0, 0, 0, 255}};
     union Pixel diff_pixel = {{0, 0, 0, 0}};
-    union Pixel cur_pixel;
-
+    union Pixel cur_pixel = prev_pixel;
 
     size_t in_index = 0;
     size_t out_index = 0;
@@ -393,12 +725,13 @@ size_t decompress_image_rgba(const ubyte* in, ubyte* out, struct qoi_header head
         prev_pixel.i = cur_pixel.i;
     }
 
+    *in_size = in_index;
     return out_index;
 }
 
 static
-size_t decompress_image_rgb(const ubyte* in, ubyte* out, struct qoi_header header){
-    const size_t pixel_count = header.w * header.h;
+size_t decompress_image_rgb(const ubyte* in, ubyte* out, struct qoi_header header, size_t *in_size){
+    const size_t pixel_count = (size_t)header.w * header.h;
     size_t pixel_counter = 0;
 
     union Pixel pixels[64];
@@ -406,6 +739,9 @@ size_t decompress_image_rgb(const ubyte* in, ubyte* out, struct qoi_header heade
     union Pixel diff_pixel = {{0, 0, 0, 0}};
     union Pixel cur_pixel = prev_pixel;
 
+    union Pixel block[RGB_BLOCK];
+    size_t block_index = 0;
+
     size_t in_index = 0;
     size_t out_index = 0;
 
@@ -419,22 +755,26 @@ size_t decompress_image_rgb(const ubyte* in, ubyte* out, struct qoi_header heade
         b = in[in_index];
 
         if( b == QOI_OP_RGB ){
-            memcpy(&out[out_index], &in[in_index+1], 3);
-            memcpy(&cur_pixel, &out[out_index], 3);
+            memcpy(&cur_pixel, &in[in_index+1], 3);
 
-            out_index += 3;
             in_index += 4;
         }
         else if((b & QOI_OP_RUN) == QOI_OP_RUN){
             run_length = (b & 63) + 1;
-            pixel_counter += run_length - 1;
+            pixel_counter += run_length;
 
             while(run_length--){
-                memcpy(&out[out_index], &prev_pixel, 3);
-                out_index += 3;
+                block[block_index].i = prev_pixel.i;
+                block_index += 1;
+                if( block_index == RGB_BLOCK ){
+                    pack_rgb_block(block, &out[out_index]);
+                    out_index += RGB_BLOCK * 3;
+                    block_index = 0;
+                }
             }
 
             in_index += 1;
+            continue;
         }
         else if( (b & QOI_OP_LUMA) == QOI_OP_LUMA){
             diff_pixel.g = (b & 63) - 32;
@@ -443,9 +783,6 @@ size_t decompress_image_rgb(const ubyte* in, ubyte* out, struct qoi_header heade
 
             cur_pixel.vec = prev_pixel.vec + diff_pixel.vec;
 
-            memcpy(&out[out_index], &cur_pixel, 3);
-
-            out_index += 3;
             in_index += 2;
         }
         else if( (b & QOI_OP_DIFF) == QOI_OP_DIFF){
@@ -454,20 +791,22 @@ size_t decompress_image_rgb(const ubyte* in, ubyte* out, struct qoi_header heade
             diff_pixel.b = b&3;
             cur_pixel.vec = prev_pixel.vec + diff_pixel.vec + (vec4u8){-2, -2, -2, 0};
 
-            memcpy(&out[out_index], &cur_pixel, 3);
-
-            out_index += 3;
             in_index += 1;
         }
         else{// QOI_OP_INDEX
-            pixels_index = b;
-            memcpy(&out[out_index], &pixels[pixels_index], 3);
-            cur_pixel.i = pixels[pixels_index].i;
+            cur_pixel.i = pixels[b].i;
 
-            out_index += 3;
             in_index += 1;
         }
 
+        block[block_index].i = cur_pixel.i;
+        block_index += 1;
+        if( block_index == RGB_BLOCK ){
+            pack_rgb_block(block, &out[out_index]);
+            out_index += RGB_BLOCK * 3;
+            block_index = 0;
+        }
+
         pixel_counter += 1;
         pixels_index = calculate_index(&cur_pixel);
 
@@ -475,71 +814,1525 @@ size_t decompress_image_rgb(const ubyte* in, ubyte* out, struct qoi_header heade
         prev_pixel.i = cur_pixel.i;
     }
 
+    for( size_t i = 0; i < block_index; i++ ){
+        memcpy(&out[out_index], &block[i], 3);
+        out_index += 3;
+    }
+
+    *in_size = in_index;
     return out_index;
 }
 
 
-size_t qoi_compress(const unsigned char in[], unsigned char out[], unsigned char channels, unsigned int w, unsigned int h){
-    struct qoi_header header;
-    size_t size;
+/*
+ Animation frames that are stored relative to the previous frame use the magic "qoid".
+ After the header the image is split in spans: a varint with the amount of unchanged pixels to skip,
+ a varint with the amount of pixels that follow as normal QOI ops, and then those ops.
+ The index and previous pixel carry over between spans, after a skip the previous pixel is the last skipped pixel
+ and it is added to the index, like every decoded pixel is.
+ Short unchanged stretches aren't worth a new span, so they are encoded as normal pixels.
+ */
+#define FRAME_MIN_SKIP 4
 
-    if( in == NULL || out == NULL || channels < 3 || channels > 4 || w == 0 || h == 0 ){
-        return 0;
+/*
+ A span after the first one follows at least FRAME_MIN_SKIP skipped pixels (or is the empty span at the end),
+ which would have cost more than its two varints. Only the varints of the first span come on top of qoi_max_compressed_image_size.
+ */
+#define FRAME_SPAN_MAX_SIZE (2 * ((sizeof(size_t) * 8 + 6) / 7))
+
+static
+size_t find_span_end(const ubyte *in, const ubyte *prev, size_t pixel_counter, size_t pixel_count, ubyte channels){
+    size_t equal;
+
+    pixel_counter += 1;
+    while( pixel_counter < pixel_count ){
+        if( memcmp(&in[pixel_counter * channels], &prev[pixel_counter * channels], channels) != 0 ){
+            pixel_counter += 1;
+            continue;
+        }
+
+        equal = count_equal_bytes(&in[pixel_counter * channels], &prev[pixel_counter * channels], (pixel_count - pixel_counter) * channels) / channels;
+        if( equal >= FRAME_MIN_SKIP || pixel_counter + equal == pixel_count ){
+            break;
+        }
+        pixel_counter += equal;
     }
+    return pixel_counter;
+}
 
-    header = write_header(out, channels, w, h);
 
-    if( channels == 4 ){
-        size = compress_image_rgba(in, out + 14, header) + 14;
-    }else{
-        size = compress_image_rgb(in, out + 14, header) + 14;
+static
+size_t compress_frame_delta(const ubyte* in, const ubyte* prev, ubyte* out, struct qoi_header settings){
+    const size_t pixel_count = (size_t)header_get_w(settings) * header_get_h(settings);
+    const ubyte channels = settings.channels;
+    struct encoder e;
+
+    size_t pixel_counter = 0;
+    size_t out_pos = 0;
+    size_t skip;
+    size_t span_end;
+
+    encoder_init(&e);
+
+    while( pixel_counter < pixel_count ){
+        skip = count_equal_bytes(&in[pixel_counter * channels], &prev[pixel_counter * channels], (pixel_count - pixel_counter) * channels) / channels;
+        pixel_counter += skip;
+        if( skip > 0 ){
+            e.prev_pixel = load_pixel(&in[(pixel_counter - 1) * channels], channels);
+            e.pixels[calculate_index(&e.prev_pixel)].i = e.prev_pixel.i;
+        }
+
+        span_end = pixel_counter < pixel_count ? find_span_end(in, prev, pixel_counter, pixel_count, channels) : pixel_count;
+
+        out_pos += write_varint(&out[out_pos], skip);
+        out_pos += write_varint(&out[out_pos], span_end - pixel_counter);
+
+        out_pos += encode_pixels(&e, &in[pixel_counter * channels], span_end - pixel_counter, &out[out_pos], channels);
+        out_pos += encode_flush(&e, &out[out_pos]);
+        pixel_counter = span_end;
     }
 
-    return size;
+    memset(&out[out_pos], 0, 7);
+    out[out_pos + 7] = 1;
+    out_pos += 8;
+    return out_pos;
 }
 
 
-size_t qoi_decompress(const unsigned char in[], unsigned char out[]){
-    struct qoi_header header;
-    size_t size;
+static
+size_t decompress_frame_delta(const ubyte* in, ubyte* out, struct qoi_header header){
+    const size_t pixel_count = (size_t)header.w * header.h;
+    const ubyte channels = header.channels;
+    struct decoder d;
 
-    if( in == NULL || out == NULL ){
-        return 0;
-    }
+    size_t pixel_counter = 0;
+    size_t in_index = 0;
+    size_t skip;
+    size_t span_length;
+    size_t run_length;
+    size_t varint_size;
 
-    header = read_header(in);
+    decoder_init(&d);
 
-    if(!qoi_header_isvalid(header) ){
-        return 0;
-    }
+    while( pixel_counter < pixel_count ){
+        varint_size = read_varint(&in[in_index], &skip);
+        if( varint_size == 0 ){
+            return 0;
+        }
+        in_index += varint_size;
 
-    if( header.channels == 3 ){
-        size = decompress_image_rgb(in + 14, out, header);
-    }else{
-        size = decompress_image_rgba(in + 14, out, header);
+        varint_size = read_varint(&in[in_index], &span_length);
+        /* The encoder never writes an empty span, and one would never advance pixel_counter */
+        if( varint_size == 0 || (skip == 0 && span_length == 0)
+            || skip > pixel_count - pixel_counter || span_length > pixel_count - pixel_counter - skip ){
+            return 0;
+        }
+        in_index += varint_size;
+
+        pixel_counter += skip;
+        if( skip > 0 ){
+            memcpy(&d.prev_pixel, &out[(pixel_counter - 1) * channels], channels);
+            d.pixels[calculate_index(&d.prev_pixel)].i = d.prev_pixel.i;
+        }
+
+        while( span_length > 0 ){
+            in_index += decode_op(&d, &in[in_index], &run_length);
+            if( run_length > span_length ){
+                return 0;
+            }
+            span_length -= run_length;
+
+            while( run_length-- ){
+                memcpy(&out[pixel_counter * channels], &d.prev_pixel, channels);
+                pixel_counter += 1;
+            }
+        }
     }
-    return size;
+
+    return in_index + 8;
 }
 
 
-size_t qoi_max_compressed_image_size(struct qoi_header h){
-    return h.w*h.h*(h.channels+1) + 14 + 8;
+static
+void save_checkpoint(struct qoi_checkpoint *cp, const struct encoder *e, size_t out_pos){
+    cp->out_pos = out_pos;
+    for( size_t i = 0; i < 64; i++ ){
+        cp->pixels[i] = e->pixels[i].i;
+    }
+    cp->prev_pixel = e->prev_pixel.i;
+    cp->run_length = e->run_length;
 }
 
 
-size_t qoi_decompressed_image_size(struct qoi_header h){
-    return h.w * h.h * h.channels;
+static
+void load_checkpoint(struct encoder *e, const struct qoi_checkpoint *cp){
+    for( size_t i = 0; i < 64; i++ ){
+        e->pixels[i].i = cp->pixels[i];
+    }
+    e->prev_pixel.i = cp->prev_pixel;
+    e->run_length = cp->run_length;
 }
 
 
-struct qoi_header qoi_header_read(const unsigned char* in){
-    if( in == NULL ){
-        return (struct qoi_header){.w = 0, .h = 0};
+static
+bool checkpoint_matches(const struct qoi_checkpoint *cp, const struct encoder *e){
+    if( cp->prev_pixel != e->prev_pixel.i || cp->run_length != e->run_length ){
+        return false;
     }
-    return read_header(in);
+    for( size_t i = 0; i < 64; i++ ){
+        if( cp->pixels[i] != e->pixels[i].i ){
+            return false;
+        }
+    }
+    return true;
 }
 
 
-bool qoi_header_isvalid(struct qoi_header h){
-    return h.w != 0 && h.h != 0 && (h.channels == 3 || h.channels == 4) && memcmp(h.magic, "qoif", 4) == 0;
+/*
+ Pixels are summed with the channels spread out over the 16 bit lanes of a 64 bit integer (r, b, g, a),
+ which is enough for 8x8 blocks and needs no unpacking of the pixel.
+ */
+static inline
+uint64_t spread_pixel(union Pixel p){
+    return (p.i & 0x00FF00FF) | ((uint64_t)(p.i & 0xFF00FF00) << 24);
+}
+
+
+static
+void write_scaled_row(uint64_t *accum, ubyte* out, struct qoi_header header, unsigned int shift, uint32_t rows){
+    const size_t scaled_w = ((size_t)header.w + (1u << shift) - 1) >> shift;
+    union Pixel p;
+    uint32_t count;
+    uint32_t columns;
+
+    for( size_t x = 0; x < scaled_w; x++ ){
+        columns = header.w - (x << shift) < (1u << shift) ? header.w - (x << shift) : (1u << shift);
+        count = columns * rows;
+        p.r = ((accum[x]       & 0xFFFF) + count / 2) / count;
+        p.b = ((accum[x] >> 16 & 0xFFFF) + count / 2) / count;
+        p.g = ((accum[x] >> 32 & 0xFFFF) + count / 2) / count;
+        p.a = ((accum[x] >> 48 & 0xFFFF) + count / 2) / count;
+        memcpy(&out[x * header.channels], &p, header.channels);
+    }
+    memset(accum, 0, scaled_w * sizeof(uint64_t));
+}
+
+
+static
+size_t decompress_image_scaled(const ubyte* in, ubyte* out, struct qoi_header header, unsigned int shift, uint64_t *accum){
+    const size_t scaled_row = (((size_t)header.w + (1u << shift) - 1) >> shift) * header.channels;
+    const uint32_t mask = (1u << shift) - 1;
+    const uint32_t w = header.w;
+
+    struct decoder d;
+    uint64_t spread;
+
+    size_t in_index = 0;
+    size_t out_index = 0;
+    size_t run_length;
+    uint32_t x = 0;
+    uint32_t y = 0;
+
+    decoder_init(&d);
+
+    while( y < header.h ){
+        in_index += decode_op(&d, &in[in_index], &run_length);
+        spread = spread_pixel(d.prev_pixel);
+
+        while( run_length-- ){
+            accum[x >> shift] += spread;
+            x += 1;
+
+            if( x == w ){
+                x = 0;
+                y += 1;
+                if( (y & mask) == 0 || y == header.h ){
+                    write_scaled_row(accum, &out[out_index], header, shift, ((y - 1) & mask) + 1);
+                    out_index += scaled_row;
+                    if( y == header.h ){
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    return out_index;
+}
+
+
+/*
+ Streaming XXH64 (seed 0), so the raw and compressed data can be hashed in small pieces while they are still in cache.
+ */
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+struct xxh64{
+    uint64_t v[4];
+    uint64_t total_len;
+    ubyte buffer[32];
+    size_t buffer_len;
+};
+
+
+static inline
+uint64_t xxh64_rotl(uint64_t x, unsigned int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+
+static inline
+uint64_t xxh64_read(const ubyte *p){
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return le64toh(v);
+}
+
+
+static inline
+uint64_t xxh64_round(uint64_t acc, uint64_t input){
+    acc += input * XXH_PRIME64_2;
+    acc = xxh64_rotl(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+
+static inline
+uint64_t xxh64_merge_round(uint64_t acc, uint64_t v){
+    acc ^= xxh64_round(0, v);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+
+static
+void xxh64_init(struct xxh64 *h){
+    h->v[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+    h->v[1] = XXH_PRIME64_2;
+    h->v[2] = 0;
+    h->v[3] = -XXH_PRIME64_1;
+    h->total_len = 0;
+    h->buffer_len = 0;
+}
+
+
+static
+void xxh64_stripe(struct xxh64 *h, const ubyte *p){
+    h->v[0] = xxh64_round(h->v[0], xxh64_read(&p[0]));
+    h->v[1] = xxh64_round(h->v[1], xxh64_read(&p[8]));
+    h->v[2] = xxh64_round(h->v[2], xxh64_read(&p[16]));
+    h->v[3] = xxh64_round(h->v[3], xxh64_read(&p[24]));
+}
+
+
+static
+void xxh64_update(struct xxh64 *h, const ubyte *p, size_t len){
+    size_t fill;
+
+    h->total_len += len;
+
+    if( h->buffer_len > 0 ){
+        fill = 32 - h->buffer_len < len ? 32 - h->buffer_len : len;
+        memcpy(&h->buffer[h->buffer_len], p, fill);
+        h->buffer_len += fill;
+        p += fill;
+        len -= fill;
+        if( h->buffer_len < 32 ){
+            return;
+        }
+        xxh64_stripe(h, h->buffer);
+        h->buffer_len = 0;
+    }
+
+    while( len >= 32 ){
+        xxh64_stripe(h, p);
+        p += 32;
+        len -= 32;
+    }
+
+    memcpy(h->buffer, p, len);
+    h->buffer_len = len;
+}
+
+
+static
+uint64_t xxh64_digest(const struct xxh64 *h){
+    const ubyte *p = h->buffer;
+    size_t len = h->buffer_len;
+    uint64_t acc;
+
+    if( h->total_len >= 32 ){
+        acc = xxh64_rotl(h->v[0], 1) + xxh64_rotl(h->v[1], 7) + xxh64_rotl(h->v[2], 12) + xxh64_rotl(h->v[3], 18);
+        for( size_t i = 0; i < 4; i++ ){
+            acc = xxh64_merge_round(acc, h->v[i]);
+        }
+    }else{
+        acc = XXH_PRIME64_5;
+    }
+    acc += h->total_len;
+
+    while( len >= 8 ){
+        acc ^= xxh64_round(0, xxh64_read(p));
+        acc = xxh64_rotl(acc, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+        len -= 8;
+    }
+    if( len >= 4 ){
+        uint32_t v;
+        memcpy(&v, p, 4);
+        acc ^= (uint64_t)le32toh(v) * XXH_PRIME64_1;
+        acc = xxh64_rotl(acc, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+        len -= 4;
+    }
+    while( len > 0 ){
+        acc ^= *p * XXH_PRIME64_5;
+        acc = xxh64_rotl(acc, 11) * XXH_PRIME64_1;
+        p += 1;
+        len -= 1;
+    }
+
+    acc ^= acc >> 33;
+    acc *= XXH_PRIME64_2;
+    acc ^= acc >> 29;
+    acc *= XXH_PRIME64_3;
+    acc ^= acc >> 32;
+    return acc;
+}
+
+
+/*
+ The hashed variants work through the image in strips of this many pixels,
+ hashing the pixels and the compressed bytes of a strip right after it is done.
+ */
+#define HASH_STRIP_PIXELS 1024
+
+static
+size_t compress_image_hashed(const ubyte* in, ubyte* out, struct qoi_header settings, struct xxh64 *pixel_hash, struct xxh64 *stream_hash){
+    const size_t pixel_count = (size_t)header_get_w(settings) * header_get_h(settings);
+    const ubyte channels = settings.channels;
+    struct encoder e;
+
+    size_t pixel_counter = 0;
+    size_t out_pos = 0;
+    size_t strip;
+    size_t strip_size;
+
+    encoder_init(&e);
+
+    while( pixel_counter < pixel_count ){
+        strip = pixel_count - pixel_counter < HASH_STRIP_PIXELS ? pixel_count - pixel_counter : HASH_STRIP_PIXELS;
+
+        strip_size = encode_pixels(&e, &in[pixel_counter * channels], strip, &out[out_pos], channels);
+        xxh64_update(pixel_hash, &in[pixel_counter * channels], strip * channels);
+        xxh64_update(stream_hash, &out[out_pos], strip_size);
+
+        out_pos += strip_size;
+        pixel_counter += strip;
+    }
+
+    strip_size = encode_flush(&e, &out[out_pos]);
+    memset(&out[out_pos + strip_size], 0, 7);
+    out[out_pos + strip_size + 7] = 1;
+    xxh64_update(stream_hash, &out[out_pos], strip_size + 8);
+    return out_pos + strip_size + 8;
+}
+
+
+static
+size_t decompress_image_hashed(const ubyte* in, ubyte* out, struct qoi_header header, struct xxh64 *pixel_hash, struct xxh64 *stream_hash){
+    const size_t pixel_count = (size_t)header.w * header.h;
+    const ubyte channels = header.channels;
+    struct decoder d;
+
+    size_t pixel_counter = 0;
+    size_t strip_end;
+    size_t in_index = 0;
+    size_t hashed_in = 0;
+    size_t hashed_pixels = 0;
+
+    decoder_init(&d);
+
+    while( pixel_counter < pixel_count ){
+        strip_end = pixel_count - pixel_counter < HASH_STRIP_PIXELS ? pixel_count : pixel_counter + HASH_STRIP_PIXELS;
+
+        if( channels == 4 ){
+            pixel_counter = decode_pixels(&d, in, &in_index, out, pixel_counter, strip_end, pixel_count, 4);
+        }else{
+            pixel_counter = decode_pixels(&d, in, &in_index, out, pixel_counter, strip_end, pixel_count, 3);
+        }
+
+        xxh64_update(pixel_hash, &out[hashed_pixels * channels], (pixel_counter - hashed_pixels) * channels);
+        xxh64_update(stream_hash, &in[hashed_in], in_index - hashed_in);
+        hashed_pixels = pixel_counter;
+        hashed_in = in_index;
+    }
+
+    xxh64_update(stream_hash, &in[in_index], 8);
+    return pixel_counter * channels;
+}
+
+
+static
+size_t op_size(ubyte b){
+    if( b == QOI_OP_RGB ){
+        return 4;
+    }
+    if( b == QOI_OP_RGBA ){
+        return 5;
+    }
+    if( (b & QOI_OP_RUN) == QOI_OP_LUMA ){
+        return 2;
+    }
+    return 1;
+}
+
+
+/*
+ Walks the ops of an image without decoding the pixels, to find how far the decoded output gets ahead of the input
+ when the compressed image sits at the end of the output buffer. Returns false if the stream doesn't fit in len bytes.
+ */
+static
+bool scan_inplace_margin(const ubyte* in, size_t len, struct qoi_header header, size_t *margin){
+    const size_t pixel_count = (size_t)header.w * header.h;
+    size_t pixel_counter = 0;
+    size_t in_index = 0;
+    size_t out_end;
+    ubyte b;
+
+    *margin = 0;
+
+    while( pixel_counter < pixel_count ){
+        if( in_index >= len ){
+            return false;
+        }
+        b = in[in_index];
+        in_index += op_size(b);
+        pixel_counter += (b & QOI_OP_RUN) == QOI_OP_RUN && b < QOI_OP_RGB ? (b & 63) + 1 : 1;
+
+        out_end = (pixel_counter < pixel_count ? pixel_counter : pixel_count) * header.channels;
+        if( out_end > in_index + 14 && out_end - (in_index + 14) > *margin ){
+            *margin = out_end - (in_index + 14);
+        }
+    }
+
+    return in_index + 8 <= len;
+}
+
+
+/*
+ qoi_validate looks at 16 tag bytes at a time. Lanes that are LUMA, RGB or RGBA tags end the fast path,
+ all the 1 byte ops before them (INDEX, DIFF and RUN) are counted at once: 1 pixel each plus the run lengths.
+ Long ops are stepped over one at a time, the block is only looked at when the next op is a short one.
+ */
+#define VALIDATE_BLOCK 16
+
+static inline
+size_t sum_bytes(vec16u8 v){
+    vec2u64 words = (vec2u64)v;
+
+    words = (words & 0x00FF00FF00FF00FF) + ((words >> 8) & 0x00FF00FF00FF00FF);
+    words = (words * 0x0001000100010001) >> 48;
+    return words[0] + words[1];
+}
+
+
+static inline
+size_t scan_short_ops(const ubyte *in, size_t *pixels){
+    const vec16u8 lanes = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+    vec16u8 tags, long_ops, runs;
+    vec2u64 mask;
+    size_t count;
+
+    memcpy(&tags, in, 16);
+
+    long_ops = (vec16u8)((tags & 0xC0) == 0x80) | (vec16u8)(tags >= 0xFE);
+    mask = (vec2u64)long_ops;
+    if( mask[0] != 0 ){
+        count = __builtin_ctzll(le64toh(mask[0])) / 8;
+    }else if( mask[1] != 0 ){
+        count = 8 + __builtin_ctzll(le64toh(mask[1])) / 8;
+    }else{
+        count = VALIDATE_BLOCK;
+    }
+
+    runs = (tags & 63) & (vec16u8)(tags >= 0xC0) & (vec16u8)(lanes < (ubyte)count);
+    *pixels = count + sum_bytes(runs);
+    return count;
+}
+
+
+/*
+ Steps over the complete ops in in until pixel_count pixels are covered, stopping early at an op that is cut off by len.
+ pixel_counter is updated, a run at the end can take it past pixel_count. Returns the amount of bytes stepped over.
+ */
+static
+size_t walk_ops(const ubyte* in, size_t len, uint64_t *pixel_counter, uint64_t pixel_count){
+    uint64_t counter = *pixel_counter;
+    size_t in_index = 0;
+    size_t pixels;
+    size_t count;
+    ubyte b;
+
+    while( counter < pixel_count ){
+        if( len - in_index >= VALIDATE_BLOCK && op_size(in[in_index]) == 1 ){
+            count = scan_short_ops(&in[in_index], &pixels);
+            if( pixels <= pixel_count - counter ){
+                in_index += count;
+                counter += pixels;
+                if( count == VALIDATE_BLOCK || counter == pixel_count ){
+                    continue;
+                }
+            }
+        }
+
+        if( in_index >= len ){
+            break;
+        }
+        b = in[in_index];
+        if( op_size(b) > len - in_index ){
+            break;
+        }
+        in_index += op_size(b);
+        counter += (b & QOI_OP_RUN) == QOI_OP_RUN && b < QOI_OP_RGB ? (b & 63) + 1 : 1;
+    }
+
+    *pixel_counter = counter;
+    return in_index;
+}
+
+
+static
+bool scan_ops(const ubyte* in, size_t len, size_t pixel_count, size_t *in_size){
+    uint64_t pixel_counter = 0;
+
+    *in_size = walk_ops(in, len, &pixel_counter, pixel_count);
+    return pixel_counter == pixel_count;
+}
+
+
+static
+bool count_ops(const ubyte* in, size_t len, size_t pixel_count, size_t *in_size, struct qoi_op_stats *stats){
+    size_t pixel_counter = 0;
+    size_t in_index = 0;
+    ubyte b;
+
+    memset(stats, 0, sizeof(*stats));
+
+    while( pixel_counter < pixel_count ){
+        if( in_index >= len ){
+            return false;
+        }
+        b = in[in_index];
+        if( op_size(b) > len - in_index ){
+            return false;
+        }
+        in_index += op_size(b);
+
+        if( b == QOI_OP_RGB ){
+            stats->rgb += 1;
+        }else if( b == QOI_OP_RGBA ){
+            stats->rgba += 1;
+        }else if( (b & QOI_OP_RUN) == QOI_OP_RUN ){
+            stats->run += 1;
+            stats->run_pixels += (b & 63) + 1;
+            pixel_counter += (b & 63);
+        }else if( (b & QOI_OP_RUN) == QOI_OP_LUMA ){
+            stats->luma += 1;
+        }else if( (b & QOI_OP_RUN) == QOI_OP_DIFF ){
+            stats->diff += 1;
+        }else{
+            stats->index += 1;
+        }
+        pixel_counter += 1;
+    }
+
+    *in_size = in_index;
+    return pixel_counter == pixel_count;
+}
+
+
+static
+size_t decompress_image_inplace(ubyte* buf, size_t in_start, struct qoi_header header){
+    const size_t pixel_count = (size_t)header.w * header.h;
+    const ubyte channels = header.channels;
+    struct decoder d;
+
+    size_t pixel_counter = 0;
+    size_t in_index = in_start;
+    size_t run_length;
+
+    decoder_init(&d);
+
+    while( pixel_counter < pixel_count ){
+        /* The whole op is read before anything is written, the output may already reach into its bytes. */
+        in_index += decode_op(&d, &buf[in_index], &run_length);
+        if( run_length > pixel_count - pixel_counter ){
+            run_length = pixel_count - pixel_counter;
+        }
+        while( run_length-- ){
+            memcpy(&buf[pixel_counter * channels], &d.prev_pixel, channels);
+            pixel_counter += 1;
+        }
+    }
+
+    return pixel_counter * channels;
+}
+
+
+/*
+ The planar functions move pixels between the planes and a small interleaved block, so the (de)interleaving
+ is done on a fixed amount of pixels at a time and the plane loads and stores can be vectorized.
+ */
+#define PLANAR_BLOCK 16
+
+static inline
+void store_planes(const union Pixel *block, size_t n, ubyte *const planes[], const size_t offsets[], ubyte channels){
+    if( n == PLANAR_BLOCK ){
+        for( size_t c = 0; c < channels; c++ ){
+            for( size_t i = 0; i < PLANAR_BLOCK; i++ ){
+                planes[c][offsets[c] + i] = block[i].vec[c];
+            }
+        }
+        return;
+    }
+    for( size_t c = 0; c < channels; c++ ){
+        for( size_t i = 0; i < n; i++ ){
+            planes[c][offsets[c] + i] = block[i].vec[c];
+        }
+    }
+}
+
+
+static inline
+void load_planes(union Pixel *block, size_t n, const ubyte *const planes[], const size_t offsets[], ubyte channels){
+    if( n == PLANAR_BLOCK ){
+        for( size_t c = 0; c < channels; c++ ){
+            for( size_t i = 0; i < PLANAR_BLOCK; i++ ){
+                block[i].vec[c] = planes[c][offsets[c] + i];
+            }
+        }
+        return;
+    }
+    for( size_t c = 0; c < channels; c++ ){
+        for( size_t i = 0; i < n; i++ ){
+            block[i].vec[c] = planes[c][offsets[c] + i];
+        }
+    }
+}
+
+
+static
+size_t decompress_image_planar(const ubyte* in, ubyte *const planes[], const size_t strides[], struct qoi_header header){
+    union Pixel block[PLANAR_BLOCK];
+    size_t offsets[4];
+    struct decoder d;
+
+    size_t in_index = 0;
+    size_t block_length = 0;
+    size_t run_length;
+    uint32_t x = 0;
+    uint32_t y = 0;
+
+    decoder_init(&d);
+
+    while( y < header.h ){
+        in_index += decode_op(&d, &in[in_index], &run_length);
+
+        while( run_length-- ){
+            block[block_length++] = d.prev_pixel;
+            x += 1;
+
+            if( block_length == PLANAR_BLOCK || x == header.w ){
+                for( size_t c = 0; c < header.channels; c++ ){
+                    offsets[c] = y * strides[c] + x - block_length;
+                }
+                store_planes(block, block_length, planes, offsets, header.channels);
+                block_length = 0;
+            }
+
+            if( x == header.w ){
+                x = 0;
+                y += 1;
+                if( y == header.h ){
+                    break;
+                }
+            }
+        }
+    }
+
+    return image_size(header.w, header.h, header.channels);
+}
+
+
+static
+size_t compress_image_planar(const ubyte *const planes[], const size_t strides[], ubyte* out, struct qoi_header settings){
+    const uint32_t w = header_get_w(settings);
+    const uint32_t h = header_get_h(settings);
+    union Pixel block[PLANAR_BLOCK];
+    size_t offsets[4];
+    struct encoder e;
+
+    size_t out_pos = 0;
+    size_t block_length;
+
+    encoder_init(&e);
+    for( size_t i = 0; i < PLANAR_BLOCK; i++ ){
+        block[i].a = 255;
+    }
+
+    for( size_t y = 0; y < h; y++ ){
+        for( size_t x = 0; x < w; x += block_length ){
+            block_length = w - x < PLANAR_BLOCK ? w - x : PLANAR_BLOCK;
+            for( size_t c = 0; c < settings.channels; c++ ){
+                offsets[c] = y * strides[c] + x;
+            }
+            load_planes(block, block_length, planes, offsets, settings.channels);
+            out_pos += encode_pixels(&e, (const ubyte*)block, block_length, &out[out_pos], 4);
+        }
+    }
+    out_pos += encode_flush(&e, &out[out_pos]);
+
+    memset(&out[out_pos], 0, 7);
+    out[out_pos + 7] = 1;
+    out_pos += 8;
+    return out_pos;
+}
+
+
+/*
+ Copies to dest without pulling the destination into the cache, for outputs that are much larger than the cache.
+ Falls back to memcpy when SSE2 isn't available.
+ */
+static
+void stream_copy(ubyte *restrict dest, const ubyte *restrict src, size_t len){
+#ifdef __SSE2__
+    const size_t head = (16 - ((uintptr_t)dest & 15)) & 15;
+
+    if( len < head + 16 ){
+        memcpy(dest, src, len);
+        return;
+    }
+
+    memcpy(dest, src, head);
+    dest += head;
+    src += head;
+    len -= head;
+
+    while( len >= 16 ){
+        _mm_stream_si128((__m128i*)dest, _mm_loadu_si128((const __m128i*)src));
+        dest += 16;
+        src += 16;
+        len -= 16;
+    }
+#endif
+    memcpy(dest, src, len);
+}
+
+
+/*
+ Pixels are decoded into a block that stays in L1 and then streamed to the output.
+ */
+#define NONTEMPORAL_BLOCK 1024
+
+static inline
+size_t decompress_image_nontemporal(const ubyte* in, ubyte* out, struct qoi_header header, ubyte channels){
+    const size_t pixel_count = (size_t)header.w * header.h;
+    ubyte block[NONTEMPORAL_BLOCK * 4] __attribute__((aligned(16)));
+    struct decoder d;
+
+    size_t pixel_counter = 0;
+    size_t in_index = 0;
+    size_t run_length = 0;
+    size_t block_pixels;
+    size_t block_length;
+
+    decoder_init(&d);
+
+    while( pixel_counter < pixel_count ){
+        block_pixels = pixel_count - pixel_counter < NONTEMPORAL_BLOCK ? pixel_count - pixel_counter : NONTEMPORAL_BLOCK;
+        block_length = 0;
+
+        while( block_length < block_pixels ){
+            if( run_length == 0 ){
+                in_index += decode_op(&d, &in[in_index], &run_length);
+            }
+            while( run_length > 0 && block_length < block_pixels ){
+                memcpy(&block[block_length * channels], &d.prev_pixel, channels);
+                block_length += 1;
+                run_length -= 1;
+            }
+        }
+
+        stream_copy(&out[pixel_counter * channels], block, block_length * channels);
+        pixel_counter += block_length;
+    }
+
+#ifdef __SSE2__
+    _mm_sfence();
+#endif
+    return pixel_counter * channels;
+}
+
+
+size_t qoi_compress(const unsigned char in[], unsigned char out[], unsigned char channels, unsigned int w, unsigned int h){
+    struct qoi_header header;
+    size_t size;
+
+    if( in == NULL || out == NULL || channels < 3 || channels > 4 || w == 0 || h == 0 ){
+        return 0;
+    }
+
+    header = write_header(out, channels, w, h);
+
+    if( channels == 4 ){
+        size = compress_image_rgba(in, out + 14, header) + 14;
+    }else{
+        size = compress_image_rgb(in, out + 14, header) + 14;
+    }
+
+    return size;
+}
+
+
+size_t qoi_decompress(const unsigned char in[], unsigned char out[]){
+    struct qoi_header header;
+    size_t size;
+    size_t in_size;
+
+    if( in == NULL || out == NULL ){
+        return 0;
+    }
+
+    header = read_header(in);
+
+    if(!qoi_header_isvalid(header) ){
+        return 0;
+    }
+
+    if( header.channels == 3 ){
+        size = decompress_image_rgb(in + 14, out, header, &in_size);
+    }else{
+        size = decompress_image_rgba(in + 14, out, header, &in_size);
+    }
+    return size;
+}
+
+
+size_t qoi_max_compressed_image_size(struct qoi_header h){
+    const size_t size = image_size(h.w, h.h, (size_t)h.channels + 1);
+
+    if( size == 0 || size > SIZE_MAX - (14 + 8) ){
+        return 0;
+    }
+    return size + 14 + 8;
+}
+
+
+size_t qoi_decompressed_image_size(struct qoi_header h){
+    return image_size(h.w, h.h, h.channels);
+}
+
+
+struct qoi_header qoi_header_read(const unsigned char* in){
+    if( in == NULL ){
+        return (struct qoi_header){.w = 0, .h = 0};
+    }
+    return read_header(in);
+}
+
+
+bool qoi_header_isvalid(struct qoi_header h){
+    return h.w != 0 && h.h != 0 && (h.channels == 3 || h.channels == 4) && memcmp(h.magic, "qoif", 4) == 0;
+}
+
+
+size_t qoi_compress_frame(const unsigned char in[], const unsigned char prev[], unsigned char out[], unsigned char channels, unsigned int w, unsigned int h){
+    struct qoi_header header;
+
+    if( prev == NULL ){
+        return qoi_compress(in, out, channels, w, h);
+    }
+
+    if( in == NULL || out == NULL || channels < 3 || channels > 4 || w == 0 || h == 0 ){
+        return 0;
+    }
+
+    header = write_header(out, channels, w, h);
+    out[3] = 'd';
+
+    return compress_frame_delta(in, prev, out + 14, header) + 14;
+}
+
+
+size_t qoi_max_frame_size(struct qoi_header h){
+    const size_t size = qoi_max_compressed_image_size(h);
+
+    if( size == 0 || size > SIZE_MAX - FRAME_SPAN_MAX_SIZE ){
+        return 0;
+    }
+    return size + FRAME_SPAN_MAX_SIZE;
+}
+
+
+size_t qoi_decompress_frame(const unsigned char in[], unsigned char out[]){
+    struct qoi_header header;
+    size_t in_size;
+
+    if( in == NULL || out == NULL ){
+        return 0;
+    }
+
+    header = read_header(in);
+
+    if( memcmp(header.magic, "qoid", 4) == 0 ){
+        memcpy(header.magic, "qoif", 4);
+        if( !qoi_header_isvalid(header) ){
+            return 0;
+        }
+        in_size = decompress_frame_delta(in + 14, out, header);
+        return in_size == 0 ? 0 : in_size + 14;
+    }
+
+    if( !qoi_header_isvalid(header) ){
+        return 0;
+    }
+
+    if( header.channels == 3 ){
+        decompress_image_rgb(in + 14, out, header, &in_size);
+    }else{
+        decompress_image_rgba(in + 14, out, header, &in_size);
+    }
+    return in_size + 14 + 8;
+}
+
+
+size_t qoi_compress_checkpoints(const unsigned char in[], unsigned char out[], unsigned char channels, unsigned int w, unsigned int h, struct qoi_checkpoint checkpoints[], unsigned int interval){
+    const size_t row_size = (size_t)w * channels;
+    struct encoder e;
+    size_t out_pos;
+
+    if( in == NULL || out == NULL || checkpoints == NULL || interval == 0 || channels < 3 || channels > 4 || w == 0 || h == 0 ){
+        return 0;
+    }
+
+    write_header(out, channels, w, h);
+    out_pos = 14;
+    encoder_init(&e);
+
+    for( size_t row = 0; row < h; row++ ){
+        if( row % interval == 0 ){
+            save_checkpoint(&checkpoints[row / interval], &e, out_pos);
+        }
+        out_pos += encode_pixels(&e, &in[row * row_size], w, &out[out_pos], channels);
+    }
+    out_pos += encode_flush(&e, &out[out_pos]);
+
+    memset(&out[out_pos], 0, 7);
+    out[out_pos + 7] = 1;
+    return out_pos + 8;
+}
+
+
+size_t qoi_recompress(const unsigned char in[], const unsigned char old[], size_t old_size, unsigned char out[], struct qoi_checkpoint checkpoints[], unsigned int interval, unsigned int first_row, unsigned int last_row){
+    struct qoi_header header;
+    struct encoder e;
+    size_t row_size;
+    size_t out_pos;
+    size_t tail_size;
+    size_t row;
+
+    if( in == NULL || old == NULL || out == NULL || checkpoints == NULL || interval == 0 || old_size < 14 + 8 ){
+        return 0;
+    }
+
+    header = read_header(old);
+    if( !qoi_header_isvalid(header) || first_row > last_row || last_row >= header.h ){
+        return 0;
+    }
+
+    row_size = (size_t)header.w * header.channels;
+    row = first_row - first_row % interval;
+    out_pos = checkpoints[row / interval].out_pos;
+    if( out_pos < 14 || out_pos > old_size - 8 ){
+        return 0;
+    }
+
+    memcpy(out, old, out_pos);
+    load_checkpoint(&e, &checkpoints[row / interval]);
+
+    for( ; row < header.h; row++ ){
+        if( row % interval == 0 ){
+            struct qoi_checkpoint *cp = &checkpoints[row / interval];
+
+            if( row > last_row && checkpoint_matches(cp, &e) ){
+                /* Same state at the same pixel, so everything from here on is the old stream moved by the size difference. */
+                tail_size = old_size - cp->out_pos;
+                memcpy(&out[out_pos], &old[cp->out_pos], tail_size);
+
+                for( size_t i = row / interval + 1; i < (header.h + interval - 1) / interval; i++ ){
+                    checkpoints[i].out_pos = checkpoints[i].out_pos - cp->out_pos + out_pos;
+                }
+                cp->out_pos = out_pos;
+                return out_pos + tail_size;
+            }
+            save_checkpoint(cp, &e, out_pos);
+        }
+        out_pos += encode_pixels(&e, &in[row * row_size], header.w, &out[out_pos], header.channels);
+    }
+    out_pos += encode_flush(&e, &out[out_pos]);
+
+    memset(&out[out_pos], 0, 7);
+    out[out_pos + 7] = 1;
+    return out_pos + 8;
+}
+
+
+size_t qoi_scaled_image_size(struct qoi_header h, unsigned int shift){
+    if( shift == 0 || shift > 3 ){
+        return 0;
+    }
+    return image_size(((uint64_t)h.w + (1u << shift) - 1) >> shift, ((uint64_t)h.h + (1u << shift) - 1) >> shift, h.channels);
+}
+
+
+size_t qoi_decompress_scaled(const unsigned char in[], unsigned char out[], unsigned int shift){
+    struct qoi_header header;
+    uint64_t *accum;
+    size_t size;
+
+    if( in == NULL || out == NULL || shift == 0 || shift > 3 ){
+        return 0;
+    }
+
+    header = read_header(in);
+
+    if( !qoi_header_isvalid(header) ){
+        return 0;
+    }
+
+    accum = calloc(((size_t)header.w + (1u << shift) - 1) >> shift, sizeof(uint64_t));
+    if( accum == NULL ){
+        return 0;
+    }
+
+    size = decompress_image_scaled(in + 14, out, header, shift, accum);
+    free(accum);
+    return size;
+}
+
+
+size_t qoi_compress_hashed(const unsigned char in[], unsigned char out[], unsigned char channels, unsigned int w, unsigned int h, struct qoi_hashes *hashes){
+    struct qoi_header header;
+    struct xxh64 pixel_hash;
+    struct xxh64 stream_hash;
+    size_t size;
+
+    if( in == NULL || out == NULL || hashes == NULL || channels < 3 || channels > 4 || w == 0 || h == 0 ){
+        return 0;
+    }
+
+    header = write_header(out, channels, w, h);
+
+    xxh64_init(&pixel_hash);
+    xxh64_init(&stream_hash);
+    xxh64_update(&stream_hash, out, 14);
+
+    size = compress_image_hashed(in, out + 14, header, &pixel_hash, &stream_hash) + 14;
+
+    hashes->pixels = xxh64_digest(&pixel_hash);
+    hashes->compressed = xxh64_digest(&stream_hash);
+    return size;
+}
+
+
+size_t qoi_decompress_hashed(const unsigned char in[], unsigned char out[], struct qoi_hashes *hashes){
+    struct qoi_header header;
+    struct xxh64 pixel_hash;
+    struct xxh64 stream_hash;
+    size_t size;
+
+    if( in == NULL || out == NULL || hashes == NULL ){
+        return 0;
+    }
+
+    header = read_header(in);
+
+    if( !qoi_header_isvalid(header) ){
+        return 0;
+    }
+
+    xxh64_init(&pixel_hash);
+    xxh64_init(&stream_hash);
+    xxh64_update(&stream_hash, in, 14);
+
+    size = decompress_image_hashed(in + 14, out, header, &pixel_hash, &stream_hash);
+
+    hashes->pixels = xxh64_digest(&pixel_hash);
+    hashes->compressed = xxh64_digest(&stream_hash);
+    return size;
+}
+
+
+size_t qoi_inplace_buffer_size(const unsigned char in[], size_t in_size){
+    struct qoi_header header;
+    size_t margin;
+    size_t raw_size;
+
+    if( in == NULL || in_size < 14 + 8 ){
+        return 0;
+    }
+
+    header = read_header(in);
+
+    if( !qoi_header_isvalid(header) || !scan_inplace_margin(in + 14, in_size - 14, header, &margin) ){
+        return 0;
+    }
+
+    raw_size = image_size(header.w, header.h, header.channels);
+    if( raw_size == 0 || in_size + margin < in_size ){
+        return 0;
+    }
+    return raw_size > in_size + margin ? raw_size : in_size + margin;
+}
+
+
+size_t qoi_decompress_inplace(unsigned char buf[], size_t buf_size, size_t in_size){
+    struct qoi_header header;
+
+    if( buf == NULL || in_size < 14 + 8 || in_size > buf_size ){
+        return 0;
+    }
+
+    header = read_header(&buf[buf_size - in_size]);
+
+    if( !qoi_header_isvalid(header) || image_size(header.w, header.h, header.channels) == 0 || image_size(header.w, header.h, header.channels) > buf_size ){
+        return 0;
+    }
+
+    return decompress_image_inplace(buf, buf_size - in_size + 14, header);
+}
+
+
+size_t qoi_decompress_planar(const unsigned char in[], unsigned char *const planes[], const size_t strides[]){
+    struct qoi_header header;
+    size_t plane_strides[4];
+
+    if( in == NULL || planes == NULL ){
+        return 0;
+    }
+
+    header = read_header(in);
+
+    if( !qoi_header_isvalid(header) ){
+        return 0;
+    }
+
+    for( size_t c = 0; c < header.channels; c++ ){
+        if( planes[c] == NULL ){
+            return 0;
+        }
+        plane_strides[c] = strides != NULL ? strides[c] : header.w;
+    }
+
+    return decompress_image_planar(in + 14, planes, plane_strides, header);
+}
+
+
+size_t qoi_compress_planar(const unsigned char *const planes[], const size_t strides[], unsigned char out[], unsigned char channels, unsigned int w, unsigned int h){
+    struct qoi_header header;
+    size_t plane_strides[4];
+
+    if( planes == NULL || out == NULL || channels < 3 || channels > 4 || w == 0 || h == 0 ){
+        return 0;
+    }
+
+    for( size_t c = 0; c < channels; c++ ){
+        if( planes[c] == NULL ){
+            return 0;
+        }
+        plane_strides[c] = strides != NULL ? strides[c] : w;
+    }
+
+    header = write_header(out, channels, w, h);
+
+    return compress_image_planar(planes, plane_strides, out + 14, header) + 14;
+}
+
+
+size_t qoi_decompress_nontemporal(const unsigned char in[], unsigned char out[]){
+    struct qoi_header header;
+
+    if( in == NULL || out == NULL ){
+        return 0;
+    }
+
+    header = read_header(in);
+
+    if( !qoi_header_isvalid(header) ){
+        return 0;
+    }
+
+    if( header.channels == 3 ){
+        return decompress_image_nontemporal(in + 14, out, header, 3);
+    }
+    return decompress_image_nontemporal(in + 14, out, header, 4);
+}
+
+
+/*
+ Allocations are rounded up to whole hugepages, explicit hugepage mappings can only be unmapped that way.
+ */
+#define HUGEPAGE_SIZE ((size_t)2 << 20)
+
+void* qoi_alloc(size_t size, unsigned int flags){
+    void *p = MAP_FAILED;
+
+    if( size == 0 || size > SIZE_MAX - HUGEPAGE_SIZE ){
+        return NULL;
+    }
+    size = (size + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1);
+
+#ifdef MAP_HUGETLB
+    if( flags & QOI_ALLOC_HUGETLB ){
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if( p == MAP_FAILED ){
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if( p == MAP_FAILED ){
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        if( flags & (QOI_ALLOC_HUGETLB | QOI_ALLOC_TRANSPARENT_HUGEPAGES) ){
+            madvise(p, size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    return p;
+}
+
+
+void qoi_free(void *p, size_t size){
+    if( p != NULL ){
+        munmap(p, (size + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1));
+    }
+}
+
+
+static
+bool validate_image(const unsigned char in[], size_t len, struct qoi_info *info, struct qoi_op_stats *stats){
+    static const ubyte end_marker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    struct qoi_header header;
+    size_t pixel_count;
+    size_t in_size;
+    bool valid;
+
+    if( in == NULL || len < 14 + 8 ){
+        return false;
+    }
+
+    header = read_header(in);
+    if( !qoi_header_isvalid(header) ){
+        return false;
+    }
+
+    pixel_count = (size_t)header.w * header.h;
+    if( stats != NULL ){
+        valid = count_ops(in + 14, len - 14 - 8, pixel_count, &in_size, stats);
+    }else{
+        valid = scan_ops(in + 14, len - 14 - 8, pixel_count, &in_size);
+    }
+
+    if( !valid || memcmp(&in[14 + in_size], end_marker, 8) != 0 ){
+        return false;
+    }
+
+    if( info != NULL ){
+        info->header = header;
+        info->pixel_count = pixel_count;
+        info->size = 14 + in_size + 8;
+    }
+    return true;
+}
+
+
+bool qoi_validate(const unsigned char in[], size_t len, struct qoi_info *info){
+    return validate_image(in, len, info, NULL);
+}
+
+
+bool qoi_validate_stats(const unsigned char in[], size_t len, struct qoi_info *info, struct qoi_op_stats *stats){
+    if( stats == NULL ){
+        return false;
+    }
+    return validate_image(in, len, info, stats);
+}
+
+
+size_t qoi_compressed_size(const unsigned char in[], size_t len){
+    struct qoi_info info;
+
+    return validate_image(in, len, &info, NULL) ? info.size : 0;
+}
+
+
+size_t qoi_walk_ops(const unsigned char in[], size_t len, uint64_t *pixel_counter, uint64_t pixel_count){
+    if( in == NULL || pixel_counter == NULL ){
+        return 0;
+    }
+    return walk_ops(in, len, pixel_counter, pixel_count);
+}
+
+
+static
+void stream_load(const struct qoi_stream *s, union Pixel pixels[64], union Pixel *prev_pixel){
+    for( size_t i = 0; i < 64; i++ ){
+        pixels[i].i = s->pixels[i];
+    }
+    prev_pixel->i = s->prev_pixel;
+}
+
+
+static
+void stream_save(struct qoi_stream *s, const union Pixel pixels[64], union Pixel prev_pixel){
+    for( size_t i = 0; i < 64; i++ ){
+        s->pixels[i] = pixels[i].i;
+    }
+    s->prev_pixel = prev_pixel.i;
+}
+
+
+size_t qoi_stream_encode_begin(struct qoi_stream *s, unsigned char out[], unsigned char channels, unsigned int w, unsigned int h){
+    if( s == NULL || out == NULL || channels < 3 || channels > 4 || w == 0 || h == 0 ){
+        return 0;
+    }
+
+    write_header(out, channels, w, h);
+    s->header = read_header(out);
+    s->pixel_count = (uint64_t)w * h;
+    s->pixel_counter = 0;
+    memset(s->pixels, 0, sizeof(s->pixels));
+    s->prev_pixel = ((union Pixel){{0, 0, 0, 255}}).i;
+    s->run_length = 0;
+    return 14;
+}
+
+
+size_t qoi_stream_encode(struct qoi_stream *s, const unsigned char in[], size_t pixels, unsigned char out[]){
+    struct encoder e;
+    size_t out_pos;
+
+    if( s == NULL || in == NULL || out == NULL || pixels > s->pixel_count - s->pixel_counter ){
+        return 0;
+    }
+
+    stream_load(s, e.pixels, &e.prev_pixel);
+    e.run_length = s->run_length;
+
+    out_pos = encode_pixels(&e, in, pixels, out, s->header.channels);
+
+    stream_save(s, e.pixels, e.prev_pixel);
+    s->run_length = e.run_length;
+    s->pixel_counter += pixels;
+    return out_pos;
+}
+
+
+size_t qoi_stream_encode_end(struct qoi_stream *s, unsigned char out[]){
+    size_t out_pos = 0;
+
+    if( s == NULL || out == NULL || s->pixel_counter != s->pixel_count ){
+        return 0;
+    }
+
+    if( s->run_length > 0 ){
+        write_qoi_run(out, s->run_length);
+        s->run_length = 0;
+        out_pos += 1;
+    }
+
+    memset(&out[out_pos], 0, 7);
+    out[out_pos + 7] = 1;
+    return out_pos + 8;
+}
+
+
+size_t qoi_stream_decode_begin(struct qoi_stream *s, const unsigned char in[], size_t len){
+    if( s == NULL || in == NULL || len < 14 ){
+        return 0;
+    }
+
+    s->header = read_header(in);
+    if( !qoi_header_isvalid(s->header) ){
+        return 0;
+    }
+
+    s->pixel_count = (uint64_t)s->header.w * s->header.h;
+    s->pixel_counter = 0;
+    memset(s->pixels, 0, sizeof(s->pixels));
+    s->prev_pixel = ((union Pixel){{0, 0, 0, 255}}).i;
+    s->run_length = 0;
+    return 14;
+}
+
+
+size_t qoi_stream_decode(struct qoi_stream *s, const unsigned char in[], size_t len, unsigned char out[], size_t max_pixels, size_t *pixels){
+    ubyte channels;
+    struct decoder d;
+    size_t in_index = 0;
+    size_t out_pixels = 0;
+    size_t run_length;
+    size_t size;
+
+    if( s == NULL || in == NULL || out == NULL || pixels == NULL ){
+        return 0;
+    }
+    channels = s->header.channels;
+    run_length = s->run_length;
+
+    if( max_pixels > s->pixel_count - s->pixel_counter ){
+        max_pixels = s->pixel_count - s->pixel_counter;
+    }
+
+    stream_load(s, d.pixels, &d.prev_pixel);
+
+    while( true ){
+        while( run_length > 0 && out_pixels < max_pixels ){
+            memcpy(&out[out_pixels * channels], &d.prev_pixel, channels);
+            out_pixels += 1;
+            run_length -= 1;
+        }
+
+        if( out_pixels == max_pixels || in_index >= len ){
+            break;
+        }
+
+        size = op_size(in[in_index]);
+        if( size > len - in_index ){
+            break;
+        }
+        in_index += decode_op(&d, &in[in_index], &run_length);
+        if( run_length > s->pixel_count - s->pixel_counter - out_pixels ){
+            run_length = s->pixel_count - s->pixel_counter - out_pixels;
+        }
+    }
+
+    stream_save(s, d.pixels, d.prev_pixel);
+    s->run_length = run_length;
+    s->pixel_counter += out_pixels;
+    *pixels = out_pixels;
+    return in_index;
+}
+
+
+size_t qoi_stream_decode_end(struct qoi_stream *s, const unsigned char in[], size_t len){
+    static const ubyte end_marker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+    if( s == NULL || in == NULL || len < 8 || s->pixel_counter != s->pixel_count || s->run_length != 0 ){
+        return 0;
+    }
+    return memcmp(in, end_marker, 8) == 0 ? 8 : 0;
 }
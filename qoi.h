@@ -32,16 +32,253 @@ NOTE: Make sure you at least have "width * height * channels" bytes allocated in
 extern size_t qoi_decompress(const unsigned char in[], unsigned char out[]);
 
 
+/*
+ Returns the size of the QOI image at the start of in (header, ops and end marker), or 0 when it isn't a valid image
+ or doesn't fit in the first len bytes. qoi_decompress doesn't know how long in is, so use this first on untrusted data.
+ */
+extern size_t qoi_compressed_size(const unsigned char in[], size_t len);
+
+
+/*
+ Compress a frame of an animation. Pixels that are the same as in prev (the previous frame) are stored as skips,
+ the changed pixels use the normal QOI ops. When prev is NULL a normal QOI image is written, which can be used as a keyframe.
+ Returns the size of the frame.
+
+ NOTE: out needs at least qoi_max_frame_size(header) bytes, the skips take a few bytes more than qoi_max_compressed_image_size in the worst case.
+
+ Frames can be written after each other to get an animation, qoi_decompress_frame returns where the next one starts.
+ */
+extern size_t qoi_compress_frame(const unsigned char in[], const unsigned char prev[], unsigned char out[], unsigned char channels, unsigned int w, unsigned int h);
+
+
+/*
+Decompresses a frame written by qoi_compress_frame. out has to contain the previous frame, which is updated in place.
+Returns the amount of bytes read from in (the start of the next frame), or 0 on failure.
+ */
+extern size_t qoi_decompress_frame(const unsigned char in[], unsigned char out[]);
+
+/*
+ The maximum size of a frame written by qoi_compress_frame, or 0 if that doesn't fit in a size_t.
+ */
+extern size_t qoi_max_frame_size(struct qoi_header h);
+
+
+/*
+ State of the encoder at the start of a row, used by qoi_recompress to continue encoding from that row.
+ out_pos is the offset in the compressed image (including the header).
+ */
+struct qoi_checkpoint{
+    size_t out_pos;
+    uint32_t pixels[64];
+    uint32_t prev_pixel;
+    uint32_t run_length;
+};
+
+/*
+ Same as qoi_compress, but stores a checkpoint every interval rows.
+
+ NOTE: checkpoints needs space for (h + interval - 1) / interval entries.
+ */
+extern size_t qoi_compress_checkpoints(const unsigned char in[], unsigned char out[], unsigned char channels, unsigned int w, unsigned int h, struct qoi_checkpoint checkpoints[], unsigned int interval);
+
+/*
+ Re-encode an image of which only rows first_row up to and including last_row changed.
+ old is the previous compressed image of old_size bytes together with its checkpoints from qoi_compress_checkpoints or an earlier qoi_recompress.
+ Encoding continues from the checkpoint before first_row. After last_row the encoder state is compared with the old checkpoints,
+ and as soon as it is the same the rest of old is copied instead of encoded. The checkpoints are updated for the new image.
+ Returns the size of the new compressed image.
+
+ NOTE: out can't be the same buffer as old, and needs as much space as qoi_compress would.
+ */
+extern size_t qoi_recompress(const unsigned char in[], const unsigned char old[], size_t old_size, unsigned char out[], struct qoi_checkpoint checkpoints[], unsigned int interval, unsigned int first_row, unsigned int last_row);
+
+
+/*
+ Decompresses a QOI image scaled down by 2^shift (1/2, 1/4 or 1/8 for shift 1 to 3) in both directions, averaging every block of pixels.
+ Only a single row of the scaled image is kept while decoding, the full size image is never stored.
+
+ NOTE: Make sure you have at least qoi_scaled_image_size(header, shift) bytes allocated in your out buffer.
+ */
+extern size_t qoi_decompress_scaled(const unsigned char in[], unsigned char out[], unsigned int shift);
+
+
+/*
+ XXH64 (seed 0) hashes of the raw pixels and of the compressed image (header and end marker included).
+ */
+struct qoi_hashes{
+    uint64_t pixels;
+    uint64_t compressed;
+};
+
+/*
+ Same as qoi_compress, but also hashes the raw and the compressed image while they are still in cache,
+ instead of needing separate passes over both buffers afterwards.
+ */
+extern size_t qoi_compress_hashed(const unsigned char in[], unsigned char out[], unsigned char channels, unsigned int w, unsigned int h, struct qoi_hashes *hashes);
+
+/*
+ Same as qoi_decompress, but also hashes the compressed input and the decompressed pixels.
+ */
+extern size_t qoi_decompress_hashed(const unsigned char in[], unsigned char out[], struct qoi_hashes *hashes);
+
+
+/*
+ The size of the buffer qoi_decompress_inplace needs to decompress the in_size bytes in in, or 0 if the image is invalid or truncated.
+ This is the decompressed size plus the margin that keeps the output from overwriting compressed bytes that still have to be read,
+ found by quickly walking the ops.
+ */
+extern size_t qoi_inplace_buffer_size(const unsigned char in[], size_t in_size);
+
+/*
+ Decompresses a QOI image into the buffer that holds it. The in_size bytes of the compressed image have to be at the end of buf,
+ which is buf_size bytes large. The decompressed image starts at the beginning of buf. Returns the size of the decompressed image.
+
+ NOTE: buf_size needs to be at least qoi_inplace_buffer_size(), otherwise the output overwrites input that is still needed.
+ */
+extern size_t qoi_decompress_inplace(unsigned char buf[], size_t buf_size, size_t in_size);
+
+
+/*
+ Decompresses a QOI image into separate planes, one per channel (R, G, B and for 4 channel images A).
+ strides holds the amount of bytes between the rows of each plane. When strides is NULL every plane is width bytes wide.
+ Returns the total amount of bytes written to the planes.
+ */
+extern size_t qoi_decompress_planar(const unsigned char in[], unsigned char *const planes[], const size_t strides[]);
+
+/*
+ Same as qoi_compress, but reads the image from separate planes, one per channel. strides works the same as with qoi_decompress_planar.
+ */
+extern size_t qoi_compress_planar(const unsigned char *const planes[], const size_t strides[], unsigned char out[], unsigned char channels, unsigned int w, unsigned int h);
+
+
+/*
+ Same as qoi_decompress, but writes the output with non-temporal stores, so decompressing a multi-GB image doesn't evict everything else from the cache.
+ Use this when the output isn't read again right away.
+ */
+extern size_t qoi_decompress_nontemporal(const unsigned char in[], unsigned char out[]);
+
+
+enum QOI_ALLOC_FLAGS{
+    QOI_ALLOC_TRANSPARENT_HUGEPAGES = 1, QOI_ALLOC_HUGETLB = 2
+};
+
+/*
+ Allocate a buffer for a (huge) image directly with mmap. With QOI_ALLOC_TRANSPARENT_HUGEPAGES the kernel is asked to back it with transparent hugepages,
+ with QOI_ALLOC_HUGETLB explicit hugepages are used if there are enough reserved (otherwise it falls back to transparent hugepages).
+ Returns NULL on failure. Free the buffer with qoi_free using the same size.
+ */
+extern void* qoi_alloc(size_t size, unsigned int flags);
+
+extern void qoi_free(void *p, size_t size);
+
+
+/*
+ What qoi_validate found out about an image. size is the amount of bytes the image takes up, from the header up to and including the end marker,
+ so in a buffer with several images after each other the next one starts at in + size.
+ */
+struct qoi_info{
+    struct qoi_header header;
+    size_t pixel_count;
+    size_t size;
+};
+
+/*
+ The amount of times every op is used in an image. run_pixels is the amount of pixels covered by all the runs together.
+ */
+struct qoi_op_stats{
+    size_t index;
+    size_t diff;
+    size_t luma;
+    size_t run;
+    size_t run_pixels;
+    size_t rgb;
+    size_t rgba;
+};
+
+/*
+ Checks whether the first len bytes of in hold a complete QOI image without decoding it: the header has to be valid, the ops have to describe
+ exactly width * height pixels and be followed by the end marker. Nothing is written except info (which can be NULL).
+ Returns false for malformed or truncated images.
+ */
+extern bool qoi_validate(const unsigned char in[], size_t len, struct qoi_info *info);
+
+/*
+ Same as qoi_validate, but also counts how often every op is used. This looks at every op separately, so it is slower than qoi_validate.
+ */
+extern bool qoi_validate_stats(const unsigned char in[], size_t len, struct qoi_info *info, struct qoi_op_stats *stats);
+
+/*
+ Steps over the ops of an image that arrives in pieces, without decoding them, to find where it ends.
+ in holds the next len bytes after the header (or after the bytes returned by the previous call). Only complete ops are stepped over,
+ until pixel_counter (which starts at 0) reaches pixel_count. Returns the amount of bytes stepped over.
+ The image ends with the 8 byte end marker once pixel_counter >= pixel_count.
+ */
+extern size_t qoi_walk_ops(const unsigned char in[], size_t len, uint64_t *pixel_counter, uint64_t pixel_count);
+
+
+/*
+ State of an image that is encoded or decoded a few pixels at a time, for when the whole image isn't in memory at once.
+ The output is the same as with qoi_compress and qoi_decompress.
+ */
+struct qoi_stream{
+    struct qoi_header header;
+    uint64_t pixel_count;
+    uint64_t pixel_counter;
+    uint32_t pixels[64];
+    uint32_t prev_pixel;
+    uint32_t run_length;
+};
+
+/*
+ Start encoding an image, writes the header to out. Returns the amount of bytes written (14), or 0 for invalid arguments.
+ */
+extern size_t qoi_stream_encode_begin(struct qoi_stream *s, unsigned char out[], unsigned char channels, unsigned int w, unsigned int h);
+
+/*
+ Encode the next pixels of the image. Returns the amount of bytes written to out.
+ The last run is held back until more pixels or qoi_stream_encode_end follow, so this can return 0.
+
+ NOTE: out needs at least pixels * (channels + 1) + 1 bytes, a run held back from the previous call is written before the first pixel.
+ */
+extern size_t qoi_stream_encode(struct qoi_stream *s, const unsigned char in[], size_t pixels, unsigned char out[]);
+
+/*
+ Finish the image once all pixels are encoded, writes the last run and the end marker (at most 9 bytes). Returns the amount of bytes written.
+ */
+extern size_t qoi_stream_encode_end(struct qoi_stream *s, unsigned char out[]);
+
+/*
+ Start decoding an image by reading its header from the len bytes in in. Returns the amount of bytes read (14), or 0 if the header is invalid or incomplete.
+ */
+extern size_t qoi_stream_decode_begin(struct qoi_stream *s, const unsigned char in[], size_t len);
+
+/*
+ Decode at most max_pixels pixels from the len bytes in in. Only complete ops are read, an op that is cut off at the end of in
+ has to be passed again with the next call. The amount of decoded pixels is stored in pixels. Returns the amount of bytes read.
+ */
+extern size_t qoi_stream_decode(struct qoi_stream *s, const unsigned char in[], size_t len, unsigned char out[], size_t max_pixels, size_t *pixels);
+
+/*
+ Check the end marker after all pixels are decoded. Returns the amount of bytes read (8), or 0 if there is no valid end marker (yet).
+ */
+extern size_t qoi_stream_decode_end(struct qoi_stream *s, const unsigned char in[], size_t len);
+
+
 /*
  Read a qoi_header from an byte buffer.
  Check the success of the function with qoi_header_isvalid();
  */
 extern struct qoi_header qoi_header_read(const unsigned char in[]);
 
+/*
+ The size functions return 0 when the size doesn't fit in a size_t, so check for that before allocating.
+ */
 extern size_t qoi_max_compressed_image_size(struct qoi_header h);
 
 extern size_t qoi_decompressed_image_size(struct qoi_header h);
 
+extern size_t qoi_scaled_image_size(struct qoi_header h, unsigned int shift);
+
 extern bool qoi_header_isvalid(struct qoi_header h);
 
 #endif
@@ -0,0 +1,455 @@
+/*
+qoi-c: a "fast" C implementation of the qoi format
+Copyright (C) 2023  atiedebee
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "qoi.h"
+#include "qoi_archive.h"
+
+typedef unsigned char ubyte;
+
+/*
+ Layout of an archive (all integers big endian):
+   0  "qoiA"
+   4  version (1)
+   8  amount of images
+  16  offset of the names
+  24  size of the names
+  32  index, 32 bytes per image sorted by name hash and then name:
+        64 bit FNV-1a hash of the name
+        offset of the image
+        size of the image
+        offset of the name in the names, 32 bit
+        length of the name, 32 bit
+  ..  names, not 0 terminated
+  ..  images, every one starting at a multiple of 16 bytes
+ */
+#define ARCHIVE_HEADER_SIZE 32
+#define ARCHIVE_ENTRY_SIZE 32
+#define ARCHIVE_ALIGN 16
+
+
+static
+uint64_t name_hash(const char *name, size_t len){
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for( size_t i = 0; i < len; i++ ){
+        hash ^= (ubyte)name[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+
+static
+uint64_t read_u64(const ubyte *p){
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return be64toh(v);
+}
+
+
+static
+uint32_t read_u32(const ubyte *p){
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return be32toh(v);
+}
+
+
+static
+void write_u64(ubyte *p, uint64_t v){
+    v = htobe64(v);
+    memcpy(p, &v, 8);
+}
+
+
+static
+void write_u32(ubyte *p, uint32_t v){
+    v = htobe32(v);
+    memcpy(p, &v, 4);
+}
+
+
+bool qoi_archive_open_memory(struct qoi_archive *ar, const unsigned char data[], size_t len){
+    uint64_t names_offset;
+
+    if( ar == NULL || data == NULL || len < ARCHIVE_HEADER_SIZE || memcmp(data, "qoiA", 4) != 0 || read_u32(&data[4]) != 1 ){
+        return false;
+    }
+
+    ar->data = data;
+    ar->len = len;
+    ar->mapped = false;
+    ar->count = read_u64(&data[8]);
+    names_offset = read_u64(&data[16]);
+    ar->names_len = read_u64(&data[24]);
+
+    if( ar->count > (len - ARCHIVE_HEADER_SIZE) / ARCHIVE_ENTRY_SIZE
+        || names_offset < ARCHIVE_HEADER_SIZE + ar->count * ARCHIVE_ENTRY_SIZE
+        || names_offset > len || ar->names_len > len - names_offset ){
+        return false;
+    }
+
+    ar->index = &data[ARCHIVE_HEADER_SIZE];
+    ar->names = &data[names_offset];
+    return true;
+}
+
+
+bool qoi_archive_open(struct qoi_archive *ar, const char *path){
+    struct stat st;
+    ubyte *data;
+    int fd;
+
+    if( ar == NULL || path == NULL ){
+        return false;
+    }
+
+    fd = open(path, O_RDONLY);
+    if( fd < 0 ){
+        return false;
+    }
+    if( fstat(fd, &st) != 0 || st.st_size < ARCHIVE_HEADER_SIZE ){
+        close(fd);
+        return false;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if( data == MAP_FAILED ){
+        return false;
+    }
+
+    if( !qoi_archive_open_memory(ar, data, st.st_size) ){
+        munmap(data, st.st_size);
+        return false;
+    }
+    ar->mapped = true;
+    return true;
+}
+
+
+void qoi_archive_close(struct qoi_archive *ar){
+    if( ar == NULL || ar->data == NULL ){
+        return;
+    }
+    if( ar->mapped ){
+        munmap((void*)ar->data, ar->len);
+    }
+    ar->data = NULL;
+    ar->len = 0;
+    ar->count = 0;
+}
+
+
+/*
+ Compares the name of an index entry with name. Returns 2 if the entry points outside the names.
+ */
+static
+int compare_entry_name(const struct qoi_archive *ar, const ubyte *entry, const char *name, size_t len){
+    const uint32_t name_offset = read_u32(&entry[24]);
+    const uint32_t name_len = read_u32(&entry[28]);
+    int cmp;
+
+    if( name_offset > ar->names_len || name_len > ar->names_len - name_offset ){
+        return 2;
+    }
+
+    cmp = memcmp(&ar->names[name_offset], name, name_len < len ? name_len : len);
+    if( cmp != 0 ){
+        return cmp < 0 ? -1 : 1;
+    }
+    return name_len < len ? -1 : name_len > len;
+}
+
+
+const unsigned char* qoi_archive_find(const struct qoi_archive *ar, const char *name, size_t *size){
+    size_t low = 0;
+    size_t high;
+    size_t len;
+    uint64_t hash;
+    const ubyte *entry;
+    uint64_t entry_hash;
+    uint64_t offset;
+    uint64_t blob_size;
+    int cmp;
+
+    if( ar == NULL || ar->data == NULL || name == NULL ){
+        return NULL;
+    }
+
+    len = strlen(name);
+    hash = name_hash(name, len);
+    high = ar->count;
+    while( low < high ){
+        const size_t mid = low + (high - low) / 2;
+
+        entry = &ar->index[mid * ARCHIVE_ENTRY_SIZE];
+        entry_hash = read_u64(entry);
+        if( entry_hash == hash ){
+            cmp = compare_entry_name(ar, entry, name, len);
+            if( cmp == 2 ){
+                return NULL;
+            }
+        }else{
+            cmp = entry_hash < hash ? -1 : 1;
+        }
+
+        if( cmp == 0 ){
+            offset = read_u64(&entry[8]);
+            blob_size = read_u64(&entry[16]);
+            if( offset > ar->len || blob_size > ar->len - offset ){
+                return NULL;
+            }
+            if( size != NULL ){
+                *size = blob_size;
+            }
+            return &ar->data[offset];
+        }
+
+        if( cmp < 0 ){
+            low = mid + 1;
+        }else{
+            high = mid;
+        }
+    }
+
+    return NULL;
+}
+
+
+size_t qoi_archive_decompress(const struct qoi_archive *ar, const char *name, unsigned char out[]){
+    size_t size;
+    const ubyte *blob = qoi_archive_find(ar, name, &size);
+
+    /* qoi_decompress has no length, so the blob is checked against its stored size first */
+    if( blob == NULL || qoi_compressed_size(blob, size) == 0 ){
+        return 0;
+    }
+    return qoi_decompress(blob, out);
+}
+
+
+struct pack_item{
+    const struct qoi_archive_entry *entry;
+    size_t name_len;
+    uint64_t hash;
+    ubyte *blob;
+    size_t blob_size;
+};
+
+struct pack_job{
+    struct pack_item *items;
+    size_t count;
+    size_t next;
+    bool failed;
+    pthread_mutex_t lock;
+};
+
+
+static
+void* pack_worker(void *arg){
+    struct pack_job *job = arg;
+    struct pack_item *item;
+    struct qoi_header header;
+    size_t size;
+    size_t i;
+
+    for( ;; ){
+        pthread_mutex_lock(&job->lock);
+        i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if( i >= job->count ){
+            break;
+        }
+
+        item = &job->items[i];
+        header.w = item->entry->w;
+        header.h = item->entry->h;
+        header.channels = item->entry->channels;
+
+        size = qoi_max_compressed_image_size(header);
+        item->blob = size != 0 ? malloc(size) : NULL;
+        item->blob_size = item->blob != NULL ? qoi_compress(item->entry->pixels, item->blob, header.channels, header.w, header.h) : 0;
+        if( item->blob_size == 0 ){
+            pthread_mutex_lock(&job->lock);
+            job->failed = true;
+            pthread_mutex_unlock(&job->lock);
+        }
+    }
+    return NULL;
+}
+
+
+static
+int compare_pack_items(const void *a, const void *b){
+    const struct pack_item *x = a;
+    const struct pack_item *y = b;
+    int cmp;
+
+    if( x->hash != y->hash ){
+        return x->hash < y->hash ? -1 : 1;
+    }
+    cmp = memcmp(x->entry->name, y->entry->name, x->name_len < y->name_len ? x->name_len : y->name_len);
+    if( cmp != 0 ){
+        return cmp;
+    }
+    return x->name_len < y->name_len ? -1 : x->name_len > y->name_len;
+}
+
+
+static
+bool write_archive(FILE *f, struct pack_item *items, size_t count){
+    static const ubyte padding[ARCHIVE_ALIGN];
+    ubyte header[ARCHIVE_HEADER_SIZE] = {'q', 'o', 'i', 'A'};
+    ubyte entry[ARCHIVE_ENTRY_SIZE];
+    const uint64_t names_offset = ARCHIVE_HEADER_SIZE + (uint64_t)count * ARCHIVE_ENTRY_SIZE;
+    uint64_t names_len = 0;
+    uint64_t offset;
+
+    for( size_t i = 0; i < count; i++ ){
+        names_len += items[i].name_len;
+    }
+
+    write_u32(&header[4], 1);
+    write_u64(&header[8], count);
+    write_u64(&header[16], names_offset);
+    write_u64(&header[24], names_len);
+    if( fwrite(header, 1, sizeof(header), f) != sizeof(header) ){
+        return false;
+    }
+
+    offset = (names_offset + names_len + ARCHIVE_ALIGN - 1) & ~(uint64_t)(ARCHIVE_ALIGN - 1);
+    names_len = 0;
+    for( size_t i = 0; i < count; i++ ){
+        write_u64(&entry[0], items[i].hash);
+        write_u64(&entry[8], offset);
+        write_u64(&entry[16], items[i].blob_size);
+        write_u32(&entry[24], names_len);
+        write_u32(&entry[28], items[i].name_len);
+        if( fwrite(entry, 1, sizeof(entry), f) != sizeof(entry) ){
+            return false;
+        }
+        names_len += items[i].name_len;
+        offset = (offset + items[i].blob_size + ARCHIVE_ALIGN - 1) & ~(uint64_t)(ARCHIVE_ALIGN - 1);
+    }
+
+    for( size_t i = 0; i < count; i++ ){
+        if( fwrite(items[i].entry->name, 1, items[i].name_len, f) != items[i].name_len ){
+            return false;
+        }
+    }
+
+    offset = names_offset + names_len;
+    for( size_t i = 0; i < count; i++ ){
+        const size_t pad = (ARCHIVE_ALIGN - offset % ARCHIVE_ALIGN) % ARCHIVE_ALIGN;
+
+        if( fwrite(padding, 1, pad, f) != pad || fwrite(items[i].blob, 1, items[i].blob_size, f) != items[i].blob_size ){
+            return false;
+        }
+        offset += pad + items[i].blob_size;
+    }
+
+    return true;
+}
+
+
+bool qoi_archive_pack(const char *path, const struct qoi_archive_entry entries[], size_t count, unsigned int threads){
+    struct pack_job job = {.count = count, .next = 0, .failed = false};
+    pthread_t *workers;
+    unsigned int started = 0;
+    FILE *f;
+    bool ok;
+
+    if( path == NULL || (entries == NULL && count > 0) ){
+        return false;
+    }
+    if( threads == 0 ){
+        threads = 1;
+    }
+
+    job.items = calloc(count + 1, sizeof(struct pack_item));
+    workers = calloc(threads, sizeof(pthread_t));
+    if( job.items == NULL || workers == NULL ){
+        free(job.items);
+        free(workers);
+        return false;
+    }
+
+    for( size_t i = 0; i < count; i++ ){
+        job.items[i].entry = &entries[i];
+        job.items[i].name_len = strlen(entries[i].name);
+        job.items[i].hash = name_hash(entries[i].name, job.items[i].name_len);
+        if( job.items[i].name_len > UINT32_MAX ){
+            job.failed = true;
+        }
+    }
+
+    /* Once the workers run job.failed is only touched under job.lock, and only read again after they are joined */
+    pthread_mutex_init(&job.lock, NULL);
+    if( !job.failed ){
+        for( unsigned int t = 1; t < threads; t++ ){
+            if( pthread_create(&workers[t], NULL, pack_worker, &job) != 0 ){
+                break;
+            }
+            started += 1;
+        }
+        pack_worker(&job);
+    }
+    for( unsigned int t = 1; t <= started; t++ ){
+        pthread_join(workers[t], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+
+    ok = !job.failed;
+    if( ok ){
+        qsort(job.items, count, sizeof(struct pack_item), compare_pack_items);
+        for( size_t i = 1; i < count; i++ ){
+            if( compare_pack_items(&job.items[i - 1], &job.items[i]) == 0 ){
+                ok = false;
+            }
+        }
+    }
+
+    if( ok ){
+        f = fopen(path, "wb");
+        ok = f != NULL && write_archive(f, job.items, count);
+        if( f != NULL && fclose(f) != 0 ){
+            ok = false;
+        }
+    }
+
+    for( size_t i = 0; i < count; i++ ){
+        free(job.items[i].blob);
+    }
+    free(job.items);
+    free(workers);
+    return ok;
+}
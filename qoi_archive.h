@@ -0,0 +1,66 @@
+#ifndef QOI_ARCHIVE_H
+#define QOI_ARCHIVE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "qoi.h"
+
+/*
+ An archive of many (small) QOI images, looked up by name. The file is mmapped once and the images are
+ decompressed straight from the mapping. The index is sorted by the hash of the names, so a lookup is a binary search.
+ */
+struct qoi_archive{
+    const unsigned char *data;
+    size_t len;
+    bool mapped;
+
+    uint64_t count;
+    const unsigned char *index;
+    const unsigned char *names;
+    uint64_t names_len;
+};
+
+/*
+ An image to put in an archive with qoi_archive_pack.
+ */
+struct qoi_archive_entry{
+    const char *name;
+    const unsigned char *pixels;
+    unsigned int w;
+    unsigned int h;
+    unsigned char channels;
+};
+
+/*
+ Open an archive file by mmapping it.
+ */
+extern bool qoi_archive_open(struct qoi_archive *ar, const char *path);
+
+/*
+ Use an archive that is already in memory. data has to stay valid while the archive is used.
+ */
+extern bool qoi_archive_open_memory(struct qoi_archive *ar, const unsigned char data[], size_t len);
+
+extern void qoi_archive_close(struct qoi_archive *ar);
+
+/*
+ Find an image in the archive. Returns a pointer to the compressed image inside the archive and stores its size in size,
+ or returns NULL if there is no image with that name.
+ */
+extern const unsigned char* qoi_archive_find(const struct qoi_archive *ar, const char *name, size_t *size);
+
+/*
+ Decompress the image with the given name into out. Returns the size of the decompressed image, or 0 if it isn't found or is corrupt.
+
+ NOTE: Use qoi_header_read on the result of qoi_archive_find to know how large out has to be.
+ */
+extern size_t qoi_archive_decompress(const struct qoi_archive *ar, const char *name, unsigned char out[]);
+
+/*
+ Compress the images in entries and write them to an archive at path. The images are compressed by threads threads
+ (at least 1 is used). Names have to be unique. Returns false on failure.
+ */
+extern bool qoi_archive_pack(const char *path, const struct qoi_archive_entry entries[], size_t count, unsigned int threads);
+
+#endif
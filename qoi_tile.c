@@ -0,0 +1,303 @@
+/*
+qoi-c: a "fast" C implementation of the qoi format
+Copyright (C) 2023  atiedebee
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+
+#include "qoi.h"
+#include "qoi_tile.h"
+
+typedef unsigned char ubyte;
+
+/*
+ Layout of the container (all integers big endian):
+   0  "qoit"
+   4  width
+   8  height
+  12  tile size
+  16  channels
+  17  colorspace
+  18  6 bytes padding, so the offset table is 8 byte aligned
+  24  (tile count + 1) 64 bit offsets from the start of the container, the last one being the end of the last tile
+  ..  a complete QOI stream for every tile, row by row
+ */
+#define TILED_HEADER_SIZE 24
+
+struct qoi_tile_cache_entry{
+    size_t tile;
+    uint64_t last_used;
+    ubyte *pixels;
+};
+
+
+static
+uint32_t tiles_for(uint32_t size, uint32_t tile_size){
+    return size == 0 ? 0 : (size - 1) / tile_size + 1;
+}
+
+
+static
+uint32_t tile_extent(uint32_t size, uint32_t tile_size, uint32_t tile){
+    const uint32_t start = tile * tile_size;
+    return size - start < tile_size ? size - start : tile_size;
+}
+
+
+static
+uint64_t read_offset(const ubyte *table, size_t tile){
+    uint64_t offset;
+    memcpy(&offset, &table[tile * 8], 8);
+    return be64toh(offset);
+}
+
+
+static
+void write_offset(ubyte *table, size_t tile, uint64_t offset){
+    offset = htobe64(offset);
+    memcpy(&table[tile * 8], &offset, 8);
+}
+
+
+size_t qoi_tiled_max_size(unsigned char channels, unsigned int w, unsigned int h){
+    const size_t tile_count = (size_t)tiles_for(w, QOI_TILE_SIZE) * tiles_for(h, QOI_TILE_SIZE);
+    size_t pixels_size;
+    size_t size;
+
+    if( __builtin_mul_overflow((size_t)w, (size_t)h, &pixels_size) || __builtin_mul_overflow(pixels_size, (size_t)channels + 1, &pixels_size)
+        || __builtin_add_overflow(pixels_size, TILED_HEADER_SIZE + (tile_count + 1) * 8 + tile_count * (14 + 8), &size) ){
+        return 0;
+    }
+    return size;
+}
+
+
+size_t qoi_tiled_compress(const unsigned char in[], unsigned char out[], unsigned char channels, unsigned int w, unsigned int h){
+    const uint32_t tiles_x = tiles_for(w, QOI_TILE_SIZE);
+    const uint32_t tiles_y = tiles_for(h, QOI_TILE_SIZE);
+    const size_t stride = (size_t)w * channels;
+    ubyte *table;
+    ubyte *tile_pixels;
+    uint32_t header_values[3];
+    size_t out_pos;
+    size_t tile = 0;
+
+    if( in == NULL || out == NULL || channels < 3 || channels > 4 || w == 0 || h == 0 ){
+        return 0;
+    }
+
+    tile_pixels = malloc((size_t)QOI_TILE_SIZE * QOI_TILE_SIZE * channels);
+    if( tile_pixels == NULL ){
+        return 0;
+    }
+
+    header_values[0] = htobe32(w);
+    header_values[1] = htobe32(h);
+    header_values[2] = htobe32(QOI_TILE_SIZE);
+    memcpy(out, "qoit", 4);
+    memcpy(&out[4], header_values, 12);
+    out[16] = channels;
+    out[17] = 0;
+    memset(&out[18], 0, 6);
+
+    table = &out[TILED_HEADER_SIZE];
+    out_pos = TILED_HEADER_SIZE + ((size_t)tiles_x * tiles_y + 1) * 8;
+
+    for( uint32_t ty = 0; ty < tiles_y; ty++ ){
+        const uint32_t tile_h = tile_extent(h, QOI_TILE_SIZE, ty);
+
+        for( uint32_t tx = 0; tx < tiles_x; tx++ ){
+            const uint32_t tile_w = tile_extent(w, QOI_TILE_SIZE, tx);
+            const size_t tile_stride = (size_t)tile_w * channels;
+            const ubyte *src = &in[(size_t)ty * QOI_TILE_SIZE * stride + (size_t)tx * QOI_TILE_SIZE * channels];
+
+            for( uint32_t row = 0; row < tile_h; row++ ){
+                memcpy(&tile_pixels[row * tile_stride], &src[row * stride], tile_stride);
+            }
+
+            write_offset(table, tile, out_pos);
+            out_pos += qoi_compress(tile_pixels, &out[out_pos], channels, tile_w, tile_h);
+            tile += 1;
+        }
+    }
+    write_offset(table, tile, out_pos);
+
+    free(tile_pixels);
+    return out_pos;
+}
+
+
+bool qoi_tiled_open(struct qoi_tiled *t, const unsigned char in[], size_t len, size_t cache_tiles){
+    uint32_t header_values[3];
+    size_t tile_bytes;
+    size_t cache_bytes;
+
+    if( t == NULL || in == NULL || len < TILED_HEADER_SIZE || memcmp(in, "qoit", 4) != 0 ){
+        return false;
+    }
+
+    memcpy(header_values, &in[4], 12);
+    t->data = in;
+    t->len = len;
+    t->w = be32toh(header_values[0]);
+    t->h = be32toh(header_values[1]);
+    t->tile_size = be32toh(header_values[2]);
+    t->channels = in[16];
+
+    /* Only the tile size qoi_tiled_compress writes is accepted, anything else is either corrupt or made to overflow the cache size */
+    if( t->w == 0 || t->h == 0 || t->tile_size != QOI_TILE_SIZE || (t->channels != 3 && t->channels != 4) ){
+        return false;
+    }
+
+    t->tiles_x = tiles_for(t->w, t->tile_size);
+    t->tiles_y = tiles_for(t->h, t->tile_size);
+    if( ((size_t)t->tiles_x * t->tiles_y + 1) * 8 > len - TILED_HEADER_SIZE ){
+        return false;
+    }
+
+    if( cache_tiles == 0 ){
+        cache_tiles = 1;
+    }
+
+    tile_bytes = (size_t)(t->w < t->tile_size ? t->w : t->tile_size) * (t->h < t->tile_size ? t->h : t->tile_size) * t->channels;
+    if( __builtin_mul_overflow(cache_tiles, tile_bytes, &cache_bytes) || cache_tiles > SIZE_MAX / sizeof(struct qoi_tile_cache_entry) ){
+        return false;
+    }
+    t->cache = malloc(cache_tiles * sizeof(struct qoi_tile_cache_entry));
+    t->cache_pixels = malloc(cache_bytes);
+    if( t->cache == NULL || t->cache_pixels == NULL ){
+        free(t->cache);
+        free(t->cache_pixels);
+        t->cache = NULL;
+        t->cache_pixels = NULL;
+        return false;
+    }
+
+    for( size_t i = 0; i < cache_tiles; i++ ){
+        t->cache[i].tile = SIZE_MAX;
+        t->cache[i].last_used = 0;
+        t->cache[i].pixels = &t->cache_pixels[i * tile_bytes];
+    }
+    t->cache_size = cache_tiles;
+    t->tick = 0;
+    return true;
+}
+
+
+static
+const ubyte* get_tile(struct qoi_tiled *t, uint32_t tx, uint32_t ty){
+    const size_t tile = (size_t)ty * t->tiles_x + tx;
+    const ubyte *table = &t->data[TILED_HEADER_SIZE];
+    struct qoi_tile_cache_entry *victim = &t->cache[0];
+    struct qoi_header header;
+    uint64_t start;
+    uint64_t end;
+
+    t->tick += 1;
+
+    for( size_t i = 0; i < t->cache_size; i++ ){
+        if( t->cache[i].tile == tile ){
+            t->cache[i].last_used = t->tick;
+            return t->cache[i].pixels;
+        }
+        if( t->cache[i].last_used < victim->last_used ){
+            victim = &t->cache[i];
+        }
+    }
+
+    start = read_offset(table, tile);
+    end = read_offset(table, tile + 1);
+    if( start >= end || end > t->len || end - start < 14 + 8 ){
+        return NULL;
+    }
+
+    header = qoi_header_read(&t->data[start]);
+    if( !qoi_header_isvalid(header) || header.channels != t->channels
+        || header.w != tile_extent(t->w, t->tile_size, tx) || header.h != tile_extent(t->h, t->tile_size, ty) ){
+        return NULL;
+    }
+
+    /* The tile is only decoded once all of it is known to lie within [start, end) */
+    if( qoi_compressed_size(&t->data[start], end - start) == 0 ){
+        return NULL;
+    }
+
+    victim->tile = SIZE_MAX;
+    if( qoi_decompress(&t->data[start], victim->pixels) == 0 ){
+        return NULL;
+    }
+    victim->tile = tile;
+    victim->last_used = t->tick;
+    return victim->pixels;
+}
+
+
+size_t qoi_tiled_decompress_rect(struct qoi_tiled *t, unsigned char out[], unsigned int x, unsigned int y, unsigned int w, unsigned int h){
+    size_t out_stride;
+    uint32_t tile_size;
+
+    if( t == NULL || t->cache == NULL || out == NULL || w == 0 || h == 0
+        || x >= t->w || y >= t->h || w > t->w - x || h > t->h - y ){
+        return 0;
+    }
+    out_stride = (size_t)w * t->channels;
+    tile_size = t->tile_size;
+
+    for( uint32_t ty = y / tile_size; ty <= (y + h - 1) / tile_size; ty++ ){
+        const uint32_t tile_y0 = ty * tile_size;
+        const uint32_t row_start = y > tile_y0 ? y - tile_y0 : 0;
+        const uint32_t row_end = (y + h) - tile_y0 < tile_extent(t->h, tile_size, ty) ? (y + h) - tile_y0 : tile_extent(t->h, tile_size, ty);
+
+        for( uint32_t tx = x / tile_size; tx <= (x + w - 1) / tile_size; tx++ ){
+            const uint32_t tile_x0 = tx * tile_size;
+            const uint32_t tile_w = tile_extent(t->w, tile_size, tx);
+            const uint32_t col_start = x > tile_x0 ? x - tile_x0 : 0;
+            const uint32_t col_end = (x + w) - tile_x0 < tile_w ? (x + w) - tile_x0 : tile_w;
+            const size_t copy_len = (size_t)(col_end - col_start) * t->channels;
+            const ubyte *pixels = get_tile(t, tx, ty);
+
+            if( pixels == NULL ){
+                return 0;
+            }
+
+            for( uint32_t row = row_start; row < row_end; row++ ){
+                memcpy(&out[(size_t)(tile_y0 + row - y) * out_stride + (size_t)(tile_x0 + col_start - x) * t->channels],
+                       &pixels[((size_t)row * tile_w + col_start) * t->channels],
+                       copy_len);
+            }
+        }
+    }
+
+    return out_stride * h;
+}
+
+
+void qoi_tiled_close(struct qoi_tiled *t){
+    if( t == NULL ){
+        return;
+    }
+    free(t->cache);
+    free(t->cache_pixels);
+    t->cache = NULL;
+    t->cache_pixels = NULL;
+    t->cache_size = 0;
+}
@@ -0,0 +1,61 @@
+#ifndef QOI_TILE_H
+#define QOI_TILE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "qoi.h"
+
+#define QOI_TILE_SIZE 256
+
+struct qoi_tile_cache_entry;
+
+/*
+ A tiled image opened for random access. Every QOI_TILE_SIZE x QOI_TILE_SIZE tile is its own QOI stream,
+ found through an offset table right after the header, so the data can be used straight from an mmap.
+ Decoded tiles are kept in a small LRU cache.
+ */
+struct qoi_tiled{
+    const unsigned char *data;
+    size_t len;
+    uint32_t w;
+    uint32_t h;
+    uint32_t tile_size;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    unsigned char channels;
+
+    struct qoi_tile_cache_entry *cache;
+    unsigned char *cache_pixels;
+    size_t cache_size;
+    uint64_t tick;
+};
+
+/*
+ The maximum amount of bytes qoi_tiled_compress can write for an image of this size, or 0 if that doesn't fit in a size_t.
+ */
+extern size_t qoi_tiled_max_size(unsigned char channels, unsigned int w, unsigned int h);
+
+/*
+ Compress an image into the tiled container. Returns the size of the container, or 0 on failure.
+
+ NOTE: out needs at least qoi_tiled_max_size(channels, w, h) bytes.
+ */
+extern size_t qoi_tiled_compress(const unsigned char in[], unsigned char out[], unsigned char channels, unsigned int w, unsigned int h);
+
+/*
+ Open a tiled container of len bytes for reading. in has to stay valid until qoi_tiled_close is called.
+ Only containers with a tile size of QOI_TILE_SIZE are accepted.
+ cache_tiles is the amount of decoded tiles that are kept around (at least 1 is used).
+ */
+extern bool qoi_tiled_open(struct qoi_tiled *t, const unsigned char in[], size_t len, size_t cache_tiles);
+
+/*
+ Decompress the rectangle at (x, y) with size w * h into out, which gets a stride of w * channels.
+ Only the tiles overlapping the rectangle are decoded. Returns the amount of bytes written, or 0 on failure.
+ */
+extern size_t qoi_tiled_decompress_rect(struct qoi_tiled *t, unsigned char out[], unsigned int x, unsigned int y, unsigned int w, unsigned int h);
+
+extern void qoi_tiled_close(struct qoi_tiled *t);
+
+#endif
@@ -0,0 +1,945 @@
+/*
+qoi-c: a "fast" C implementation of the qoi format
+Copyright (C) 2023  atiedebee
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+ qoiconv: converts a stream of PAM, PPM, farbfeld or QOI images on stdin to another one of those formats on stdout.
+ The images can simply be concatenated.
+
+ The conversion is split in three stages that run at the same time:
+   reader   parses the image headers on stdin and passes the image data to a job, without looking at the pixels
+   workers  one job (image) each, decode the input format and encode the output format as the data comes in
+   writer   writes the output of the jobs to stdout in the same order as the images came in
+ Every job has a ring buffer for its input and one for its output, both with a fixed size, so a large image streams through
+ with bounded memory and the first rows are encoded while the rest is still being read. Small images fit in the rings completely,
+ so the reader can move on to the next image while the previous ones are still being converted on the other cores.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+
+#include "qoi.h"
+
+typedef unsigned char ubyte;
+
+#define RING_SIZE ((size_t)1 << 22)
+#define INPUT_SIZE ((size_t)1 << 16)
+#define STEP_PIXELS ((size_t)1 << 12)
+#define MAX_THREADS 64
+
+enum format{
+    FORMAT_NONE, FORMAT_QOI, FORMAT_PAM, FORMAT_PPM, FORMAT_FARBFELD
+};
+
+/*
+ A single producer, single consumer ring buffer. head and tail count all bytes ever written and read,
+ the data is only copied outside of the lock since the producer and consumer never touch the same bytes.
+ */
+struct ring{
+    ubyte *data;
+    size_t head;
+    size_t tail;
+    bool closed;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+struct job{
+    enum format in_format;
+    enum format out_format;
+    uint32_t w;
+    uint32_t h;
+    ubyte channels;
+
+    struct ring in;
+    struct ring out;
+};
+
+/*
+ There are never more jobs than slots (see main), so a queue doesn't have to grow.
+ */
+struct queue{
+    struct job *jobs[MAX_THREADS + 1];
+    size_t head;
+    size_t tail;
+    bool closed;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+struct input{
+    ubyte buf[INPUT_SIZE];
+    size_t pos;
+    size_t len;
+    bool eof;
+};
+
+/*
+ The input side of a worker: bytes from the input ring of the job, turned into 3 or 4 channel 8 bit pixels.
+ */
+struct source{
+    ubyte buf[INPUT_SIZE];
+    size_t pos;
+    size_t len;
+    bool eof;
+    struct qoi_stream qoi;
+};
+
+struct pipeline{
+    struct queue work;
+    struct queue write;
+    sem_t slots;
+    enum format target;
+};
+
+
+static pthread_mutex_t die_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static
+void die(const char *msg){
+    pthread_mutex_lock(&die_lock);
+    fprintf(stderr, "qoiconv: %s\n", msg);
+    exit(1);
+}
+
+
+static
+void* xmalloc(size_t size){
+    void *p = malloc(size);
+    if( p == NULL ){
+        die("out of memory");
+    }
+    return p;
+}
+
+
+static
+void ring_init(struct ring *r){
+    r->data = xmalloc(RING_SIZE);
+    r->head = 0;
+    r->tail = 0;
+    r->closed = false;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+}
+
+
+static
+void ring_destroy(struct ring *r){
+    free(r->data);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+}
+
+
+static
+void ring_write(struct ring *r, const ubyte *data, size_t len){
+    size_t head;
+    size_t n;
+    size_t first;
+
+    while( len > 0 ){
+        pthread_mutex_lock(&r->lock);
+        while( r->head - r->tail == RING_SIZE ){
+            pthread_cond_wait(&r->cond, &r->lock);
+        }
+        head = r->head;
+        n = RING_SIZE - (head - r->tail);
+        pthread_mutex_unlock(&r->lock);
+
+        n = n < len ? n : len;
+        first = RING_SIZE - head % RING_SIZE;
+        first = first < n ? first : n;
+        memcpy(&r->data[head % RING_SIZE], data, first);
+        memcpy(r->data, &data[first], n - first);
+
+        pthread_mutex_lock(&r->lock);
+        r->head += n;
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+
+        data += n;
+        len -= n;
+    }
+}
+
+
+/*
+ Reads at most max bytes, waiting until there is at least one. Returns 0 once the ring is closed and empty.
+ */
+static
+size_t ring_read(struct ring *r, ubyte *data, size_t max){
+    size_t tail;
+    size_t n;
+    size_t first;
+
+    pthread_mutex_lock(&r->lock);
+    while( r->head == r->tail && !r->closed ){
+        pthread_cond_wait(&r->cond, &r->lock);
+    }
+    tail = r->tail;
+    n = r->head - tail;
+    pthread_mutex_unlock(&r->lock);
+
+    n = n < max ? n : max;
+    first = RING_SIZE - tail % RING_SIZE;
+    first = first < n ? first : n;
+    memcpy(data, &r->data[tail % RING_SIZE], first);
+    memcpy(&data[first], r->data, n - first);
+
+    pthread_mutex_lock(&r->lock);
+    r->tail += n;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    return n;
+}
+
+
+static
+void ring_close(struct ring *r){
+    pthread_mutex_lock(&r->lock);
+    r->closed = true;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
+
+static
+void queue_init(struct queue *q){
+    q->head = 0;
+    q->tail = 0;
+    q->closed = false;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+}
+
+
+static
+void queue_push(struct queue *q, struct job *job){
+    pthread_mutex_lock(&q->lock);
+    q->jobs[q->head % (MAX_THREADS + 1)] = job;
+    q->head += 1;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+
+/*
+ Returns the next job, or NULL once the queue is closed and empty.
+ */
+static
+struct job* queue_pop(struct queue *q){
+    struct job *job = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    while( q->head == q->tail && !q->closed ){
+        pthread_cond_wait(&q->cond, &q->lock);
+    }
+    if( q->head != q->tail ){
+        job = q->jobs[q->tail % (MAX_THREADS + 1)];
+        q->tail += 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return job;
+}
+
+
+static
+void queue_close(struct queue *q){
+    pthread_mutex_lock(&q->lock);
+    q->closed = true;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+
+/*
+ The reader
+ */
+
+static
+bool input_fill(struct input *in){
+    ssize_t n;
+
+    if( in->pos < in->len ){
+        return true;
+    }
+    if( in->eof ){
+        return false;
+    }
+
+    do{
+        n = read(STDIN_FILENO, in->buf, INPUT_SIZE);
+    }while( n < 0 && errno == EINTR );
+
+    if( n < 0 ){
+        die("can't read from stdin");
+    }
+    in->pos = 0;
+    in->len = n;
+    in->eof = n == 0;
+    return n > 0;
+}
+
+
+/*
+ Reads more input after the bytes that are still buffered. Returns false at the end of the input.
+ */
+static
+bool input_keep(struct input *in){
+    ssize_t n;
+
+    memmove(in->buf, &in->buf[in->pos], in->len - in->pos);
+    in->len -= in->pos;
+    in->pos = 0;
+
+    do{
+        n = read(STDIN_FILENO, &in->buf[in->len], INPUT_SIZE - in->len);
+    }while( n < 0 && errno == EINTR );
+
+    if( n < 0 ){
+        die("can't read from stdin");
+    }
+    in->len += n;
+    in->eof = n == 0;
+    return n > 0;
+}
+
+
+static
+int input_getc(struct input *in){
+    if( !input_fill(in) ){
+        return -1;
+    }
+    return in->buf[in->pos++];
+}
+
+
+static
+void input_read(struct input *in, ubyte *out, size_t len){
+    size_t n;
+
+    while( len > 0 ){
+        if( !input_fill(in) ){
+            die("truncated image header");
+        }
+        n = in->len - in->pos < len ? in->len - in->pos : len;
+        memcpy(out, &in->buf[in->pos], n);
+        in->pos += n;
+        out += n;
+        len -= n;
+    }
+}
+
+
+static
+bool is_space(int c){
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+
+/*
+ Reads a number from a PPM header, skipping whitespace and comments before it. The character after the number is consumed as well.
+ */
+static
+uint64_t read_ppm_number(struct input *in){
+    uint64_t value = 0;
+    int c = input_getc(in);
+
+    while( is_space(c) || c == '#' ){
+        if( c == '#' ){
+            while( c != '\n' && c != -1 ){
+                c = input_getc(in);
+            }
+        }
+        c = input_getc(in);
+    }
+
+    if( c < '0' || c > '9' ){
+        die("invalid PPM header");
+    }
+    while( c >= '0' && c <= '9' ){
+        value = value * 10 + (c - '0');
+        if( value > UINT32_MAX ){
+            die("PPM dimensions too large");
+        }
+        c = input_getc(in);
+    }
+    if( !is_space(c) ){
+        die("invalid PPM header");
+    }
+    return value;
+}
+
+
+static
+void read_ppm_header(struct input *in, struct job *job){
+    uint64_t maxval;
+
+    job->w = read_ppm_number(in);
+    job->h = read_ppm_number(in);
+    maxval = read_ppm_number(in);
+    if( maxval != 255 ){
+        die("only PPM images with a maxval of 255 are supported");
+    }
+    job->channels = 3;
+}
+
+
+static
+void read_pam_header(struct input *in, struct job *job){
+    char line[256];
+    char keyword[16];
+    unsigned long value;
+    size_t len;
+    int c;
+    uint32_t depth = 0;
+    uint32_t maxval = 0;
+
+    if( input_getc(in) != '\n' ){
+        die("invalid PAM header");
+    }
+    job->w = 0;
+    job->h = 0;
+
+    while( true ){
+        len = 0;
+        while( (c = input_getc(in)) != '\n' ){
+            if( c == -1 || len == sizeof(line) - 1 ){
+                die("invalid PAM header");
+            }
+            line[len++] = c;
+        }
+        line[len] = '\0';
+
+        if( len == 0 || line[0] == '#' ){
+            continue;
+        }
+        if( strcmp(line, "ENDHDR") == 0 ){
+            break;
+        }
+        if( sscanf(line, "%15s %lu", keyword, &value) != 2 ){
+            continue; /* TUPLTYPE, the depth is enough to know the layout */
+        }
+
+        if( value > UINT32_MAX ){
+            die("PAM dimensions too large");
+        }else if( strcmp(keyword, "WIDTH") == 0 ){
+            job->w = value;
+        }else if( strcmp(keyword, "HEIGHT") == 0 ){
+            job->h = value;
+        }else if( strcmp(keyword, "DEPTH") == 0 ){
+            depth = value;
+        }else if( strcmp(keyword, "MAXVAL") == 0 ){
+            maxval = value;
+        }
+    }
+
+    if( depth != 3 && depth != 4 ){
+        die("only PAM images with a depth of 3 (RGB) or 4 (RGB_ALPHA) are supported");
+    }
+    if( maxval != 255 ){
+        die("only PAM images with a maxval of 255 are supported");
+    }
+    job->channels = depth;
+}
+
+
+/*
+ Reads the header of the next image. Returns false at the end of the input.
+ For QOI images the header is needed by the worker as well, so it's stored in qoi_header.
+ */
+static
+bool read_header(struct input *in, struct job *job, ubyte qoi_header[14]){
+    ubyte magic[8];
+    uint32_t size[2];
+    struct qoi_header header;
+
+    if( !input_fill(in) ){
+        return false;
+    }
+    input_read(in, magic, 2);
+
+    if( memcmp(magic, "P6", 2) == 0 ){
+        job->in_format = FORMAT_PPM;
+        read_ppm_header(in, job);
+    }
+    else if( memcmp(magic, "P7", 2) == 0 ){
+        job->in_format = FORMAT_PAM;
+        read_pam_header(in, job);
+    }
+    else if( memcmp(magic, "qo", 2) == 0 ){
+        memcpy(qoi_header, magic, 2);
+        input_read(in, &qoi_header[2], 12);
+        header = qoi_header_read(qoi_header);
+        if( !qoi_header_isvalid(header) ){
+            die("invalid QOI header");
+        }
+        job->in_format = FORMAT_QOI;
+        job->w = header.w;
+        job->h = header.h;
+        job->channels = header.channels;
+    }
+    else if( memcmp(magic, "fa", 2) == 0 ){
+        input_read(in, &magic[2], 6);
+        if( memcmp(magic, "farbfeld", 8) != 0 ){
+            die("unknown image format");
+        }
+        input_read(in, (ubyte*)size, 8);
+        job->in_format = FORMAT_FARBFELD;
+        job->w = be32toh(size[0]);
+        job->h = be32toh(size[1]);
+        job->channels = 4;
+    }
+    else{
+        die("unknown image format");
+    }
+
+    if( job->w == 0 || job->h == 0 ){
+        die("empty image");
+    }
+    return true;
+}
+
+
+/*
+ Passes the next bytes bytes of the input to the job.
+ */
+static
+void transfer_raw(struct input *in, struct ring *r, uint64_t bytes){
+    size_t n;
+
+    while( bytes > 0 ){
+        if( !input_fill(in) ){
+            die("truncated image");
+        }
+        n = in->len - in->pos < bytes ? in->len - in->pos : bytes;
+        ring_write(r, &in->buf[in->pos], n);
+        in->pos += n;
+        bytes -= n;
+    }
+}
+
+
+/*
+ A QOI image doesn't store its size, so the ops are walked (without decoding them) to find where it ends.
+ */
+static
+void transfer_qoi(struct input *in, struct ring *r, uint64_t pixel_count){
+    uint64_t pixel_counter = 0;
+    size_t n;
+
+    while( pixel_counter < pixel_count ){
+        if( !input_fill(in) ){
+            die("truncated image");
+        }
+        n = qoi_walk_ops(&in->buf[in->pos], in->len - in->pos, &pixel_counter, pixel_count);
+        ring_write(r, &in->buf[in->pos], n);
+        in->pos += n;
+
+        /* The next op is cut off at the end of the buffer */
+        if( n == 0 && !input_keep(in) ){
+            die("truncated image");
+        }
+    }
+
+    transfer_raw(in, r, 8);
+}
+
+
+static
+void* reader_main(void *arg){
+    struct pipeline *p = arg;
+    struct input *in = xmalloc(sizeof(*in));
+    ubyte qoi_header[14];
+    struct job *job;
+    struct job next;
+    uint64_t pixel_count;
+
+    in->pos = 0;
+    in->len = 0;
+    in->eof = false;
+
+    while( read_header(in, &next, qoi_header) ){
+        sem_wait(&p->slots);
+
+        job = xmalloc(sizeof(*job));
+        *job = next;
+        job->out_format = p->target;
+        if( job->out_format == FORMAT_NONE ){
+            job->out_format = job->in_format == FORMAT_QOI ? FORMAT_PAM : FORMAT_QOI;
+        }
+        ring_init(&job->in);
+        ring_init(&job->out);
+
+        queue_push(&p->work, job);
+        queue_push(&p->write, job);
+
+        pixel_count = (uint64_t)job->w * job->h;
+        if( job->in_format == FORMAT_QOI ){
+            ring_write(&job->in, qoi_header, 14);
+            transfer_qoi(in, &job->in, pixel_count);
+        }else if( job->in_format == FORMAT_FARBFELD ){
+            transfer_raw(in, &job->in, pixel_count * 8);
+        }else{
+            transfer_raw(in, &job->in, pixel_count * job->channels);
+        }
+        ring_close(&job->in);
+    }
+
+    queue_close(&p->work);
+    queue_close(&p->write);
+    free(in);
+    return NULL;
+}
+
+
+/*
+ The workers
+ */
+
+/*
+ Makes sure at least need bytes are buffered, unless the input of the job ends first. Returns the amount of buffered bytes.
+ */
+static
+size_t source_fill(struct source *src, struct ring *r, size_t need){
+    size_t n;
+
+    if( src->len - src->pos >= need || src->eof ){
+        return src->len - src->pos;
+    }
+
+    memmove(src->buf, &src->buf[src->pos], src->len - src->pos);
+    src->len -= src->pos;
+    src->pos = 0;
+
+    while( src->len < need ){
+        n = ring_read(r, &src->buf[src->len], INPUT_SIZE - src->len);
+        if( n == 0 ){
+            src->eof = true;
+            break;
+        }
+        src->len += n;
+    }
+    return src->len;
+}
+
+
+static
+void source_begin(struct source *src, struct job *job){
+    src->pos = 0;
+    src->len = 0;
+    src->eof = false;
+
+    if( job->in_format == FORMAT_QOI ){
+        source_fill(src, &job->in, 14);
+        src->pos += qoi_stream_decode_begin(&src->qoi, &src->buf[src->pos], src->len - src->pos);
+    }
+}
+
+
+/*
+ Decodes at most max pixels of the image into pixels. Returns the amount of decoded pixels, 0 at the end of the image.
+ */
+static
+size_t source_read(struct source *src, struct job *job, ubyte *pixels, size_t max){
+    const size_t pixel_size = job->in_format == FORMAT_FARBFELD ? 8 : job->channels;
+    uint16_t value;
+    size_t available;
+    size_t count;
+
+    if( job->in_format == FORMAT_QOI ){
+        while( src->qoi.pixel_counter < src->qoi.pixel_count ){
+            src->pos += qoi_stream_decode(&src->qoi, &src->buf[src->pos], src->len - src->pos, pixels, max, &count);
+            if( count > 0 ){
+                return count;
+            }
+            /* The next op is cut off at the end of the buffer */
+            available = src->len - src->pos;
+            if( source_fill(src, &job->in, available + 1) == available ){
+                die("truncated QOI image");
+            }
+        }
+        return 0;
+    }
+
+    available = source_fill(src, &job->in, pixel_size);
+    count = available / pixel_size < max ? available / pixel_size : max;
+
+    if( job->in_format == FORMAT_FARBFELD ){
+        for( size_t i = 0; i < count * 4; i++ ){
+            memcpy(&value, &src->buf[src->pos + i * 2], 2);
+            pixels[i] = ((uint32_t)be16toh(value) * 255 + 32767) / 65535;
+        }
+    }else{
+        memcpy(pixels, &src->buf[src->pos], count * pixel_size);
+    }
+    src->pos += count * pixel_size;
+    return count;
+}
+
+
+static
+void source_end(struct source *src, struct job *job){
+    if( job->in_format == FORMAT_QOI ){
+        source_fill(src, &job->in, 8);
+        if( qoi_stream_decode_end(&src->qoi, &src->buf[src->pos], src->len - src->pos) == 0 ){
+            die("invalid QOI image");
+        }
+    }
+}
+
+
+static
+void sink_begin(struct qoi_stream *qoi, struct job *job, ubyte *out){
+    size_t len = 0;
+    uint32_t size[2];
+
+    switch( job->out_format ){
+        case FORMAT_QOI:
+            len = qoi_stream_encode_begin(qoi, out, job->channels, job->w, job->h);
+            break;
+        case FORMAT_PAM:
+            len = sprintf((char*)out, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH %u\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+                          (unsigned int)job->w, (unsigned int)job->h, (unsigned int)job->channels, job->channels == 4 ? "RGB_ALPHA" : "RGB");
+            break;
+        case FORMAT_PPM:
+            len = sprintf((char*)out, "P6\n%u %u\n255\n", (unsigned int)job->w, (unsigned int)job->h);
+            break;
+        case FORMAT_FARBFELD:
+            size[0] = htobe32(job->w);
+            size[1] = htobe32(job->h);
+            memcpy(out, "farbfeld", 8);
+            memcpy(&out[8], size, 8);
+            len = 16;
+            break;
+        case FORMAT_NONE:
+            break;
+    }
+    ring_write(&job->out, out, len);
+}
+
+
+static
+void sink_write(struct qoi_stream *qoi, struct job *job, const ubyte *pixels, size_t count, ubyte *out){
+    const ubyte channels = job->channels;
+    uint16_t value;
+    size_t len = 0;
+
+    switch( job->out_format ){
+        case FORMAT_QOI:
+            len = qoi_stream_encode(qoi, pixels, count, out);
+            break;
+        case FORMAT_PAM:
+            ring_write(&job->out, pixels, count * channels);
+            return;
+        case FORMAT_PPM:
+            if( channels == 3 ){
+                ring_write(&job->out, pixels, count * 3);
+                return;
+            }
+            for( size_t i = 0; i < count; i++ ){
+                memcpy(&out[i * 3], &pixels[i * 4], 3);
+            }
+            len = count * 3;
+            break;
+        case FORMAT_FARBFELD:
+            for( size_t i = 0; i < count; i++ ){
+                for( size_t c = 0; c < 4; c++ ){
+                    value = htobe16(c < channels ? pixels[i * channels + c] * 257 : 0xFFFF);
+                    memcpy(&out[i * 8 + c * 2], &value, 2);
+                }
+            }
+            len = count * 8;
+            break;
+        case FORMAT_NONE:
+            break;
+    }
+    ring_write(&job->out, out, len);
+}
+
+
+static
+void sink_end(struct qoi_stream *qoi, struct job *job, ubyte *out){
+    if( job->out_format == FORMAT_QOI ){
+        ring_write(&job->out, out, qoi_stream_encode_end(qoi, out));
+    }
+}
+
+
+static
+void convert(struct job *job, struct source *src, ubyte *pixels, ubyte *out){
+    const uint64_t pixel_count = (uint64_t)job->w * job->h;
+    uint64_t pixel_counter = 0;
+    struct qoi_stream qoi;
+    size_t count;
+
+    source_begin(src, job);
+    sink_begin(&qoi, job, out);
+
+    while( pixel_counter < pixel_count ){
+        count = source_read(src, job, pixels, STEP_PIXELS);
+        if( count == 0 ){
+            die("truncated image");
+        }
+        sink_write(&qoi, job, pixels, count, out);
+        pixel_counter += count;
+    }
+
+    source_end(src, job);
+    sink_end(&qoi, job, out);
+}
+
+
+static
+void* worker_main(void *arg){
+    struct pipeline *p = arg;
+    struct source *src = xmalloc(sizeof(*src));
+    ubyte *pixels = xmalloc(STEP_PIXELS * 4);
+    ubyte *out = xmalloc(STEP_PIXELS * 8 + 256);
+    struct job *job;
+
+    while( (job = queue_pop(&p->work)) != NULL ){
+        convert(job, src, pixels, out);
+        /* Wait until the reader is done with the job too, the writer frees it once the output is closed */
+        while( ring_read(&job->in, src->buf, INPUT_SIZE) > 0 ){
+        }
+        ring_close(&job->out);
+    }
+
+    free(src);
+    free(pixels);
+    free(out);
+    return NULL;
+}
+
+
+/*
+ The writer, runs on the main thread
+ */
+
+static
+void write_output(struct pipeline *p){
+    ubyte *buf = xmalloc(INPUT_SIZE);
+    struct job *job;
+    size_t n;
+
+    while( (job = queue_pop(&p->write)) != NULL ){
+        while( (n = ring_read(&job->out, buf, INPUT_SIZE)) > 0 ){
+            if( fwrite(buf, 1, n, stdout) != n ){
+                die("can't write to stdout");
+            }
+        }
+
+        ring_destroy(&job->in);
+        ring_destroy(&job->out);
+        free(job);
+        sem_post(&p->slots);
+    }
+
+    if( fflush(stdout) != 0 ){
+        die("can't write to stdout");
+    }
+    free(buf);
+}
+
+
+static
+void usage(void){
+    fprintf(stderr,
+        "usage: qoiconv [-t qoi|pam|ppm|ff] [-j threads] < in > out\n"
+        "Converts PAM, PPM, farbfeld and QOI images, which can be concatenated, from stdin to stdout.\n"
+        "By default QOI images are converted to PAM and the other formats to QOI.\n"
+        "  -t format   the output format\n"
+        "  -j threads  the amount of images that are converted at the same time (default: the amount of cores)\n");
+    exit(1);
+}
+
+
+int main(int argc, char **argv){
+    struct pipeline p;
+    pthread_t reader;
+    pthread_t workers[MAX_THREADS];
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    p.target = FORMAT_NONE;
+
+    while( (opt = getopt(argc, argv, "t:j:h")) != -1 ){
+        switch( opt ){
+            case 't':
+                if( strcmp(optarg, "qoi") == 0 ){
+                    p.target = FORMAT_QOI;
+                }else if( strcmp(optarg, "pam") == 0 ){
+                    p.target = FORMAT_PAM;
+                }else if( strcmp(optarg, "ppm") == 0 ){
+                    p.target = FORMAT_PPM;
+                }else if( strcmp(optarg, "ff") == 0 || strcmp(optarg, "farbfeld") == 0 ){
+                    p.target = FORMAT_FARBFELD;
+                }else{
+                    usage();
+                }
+                break;
+            case 'j':
+                threads = strtol(optarg, NULL, 10);
+                break;
+            default:
+                usage();
+        }
+    }
+    if( optind != argc ){
+        usage();
+    }
+    if( threads < 1 ){
+        threads = 1;
+    }
+    if( threads > MAX_THREADS ){
+        threads = MAX_THREADS;
+    }
+
+    queue_init(&p.work);
+    queue_init(&p.write);
+    /* One image more than there are workers, so the reader can already fill the next one */
+    sem_init(&p.slots, 0, threads + 1);
+
+    if( pthread_create(&reader, NULL, reader_main, &p) != 0 ){
+        die("can't create threads");
+    }
+    for( long i = 0; i < threads; i++ ){
+        if( pthread_create(&workers[i], NULL, worker_main, &p) != 0 ){
+            die("can't create threads");
+        }
+    }
+
+    write_output(&p);
+
+    pthread_join(reader, NULL);
+    for( long i = 0; i < threads; i++ ){
+        pthread_join(workers[i], NULL);
+    }
+    return 0;
+}
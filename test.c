@@ -5,8 +5,11 @@
 #include <sys/time.h>
 #include <float.h>
 #include <limits.h>
+#include <string.h>
 
 #include "qoi.h"
+#include "qoi_tile.h"
+#include "qoi_archive.h"
 
 void benchmark_decompress_rgba(){
 	FILE* f = fopen("test_rgba.qoi", "r");
@@ -218,6 +221,477 @@ bool test_decompress(const char* fin_name, const char *fout_name){
 }
 
 
+/*
+ Round-trip checks for the API next to qoi_compress/qoi_decompress. They use generated images, so no test images are needed.
+ */
+#define TEST_W 601
+#define TEST_H 299
+
+unsigned char *make_image(unsigned int w, unsigned int h, unsigned char channels, unsigned int seed){
+	unsigned char *image = malloc((size_t)w * h * channels);
+	unsigned char pixel[4] = {0, 0, 0, 255};
+	unsigned int state = seed;
+
+	for( size_t i = 0; i < (size_t)w * h; i++ ){
+		state = state * 1103515245 + 12345;
+		if( (state >> 16) % 8 < 3 ){
+			/* keep the previous pixel, for runs */
+		}else if( (state >> 16) % 8 < 6 ){
+			for( size_t c = 0; c < 3; c++ ){
+				pixel[c] += (state >> (8 + c * 4)) % 5 - 2;
+			}
+		}else{
+			for( size_t c = 0; c < channels; c++ ){
+				pixel[c] = state >> (c * 8);
+			}
+		}
+		memcpy(&image[i * channels], pixel, channels);
+	}
+	return image;
+}
+
+
+bool check(bool ok, const char *name, unsigned char channels){
+	if( !ok ){
+		fprintf(stderr, "FAILED: %s (%d channels)\n", name, channels);
+	}
+	return ok;
+}
+
+
+bool test_tiled(const unsigned char *image, unsigned char channels){
+	const unsigned int x = 100, y = 50, w = 400, h = 230;
+	unsigned char *container = malloc(qoi_tiled_max_size(channels, TEST_W, TEST_H));
+	unsigned char *out = malloc((size_t)w * h * channels);
+	size_t len = qoi_tiled_compress(image, container, channels, TEST_W, TEST_H);
+	struct qoi_tiled t;
+	bool ok = len != 0 && qoi_tiled_open(&t, container, len, 2);
+
+	if( ok ){
+		ok = qoi_tiled_decompress_rect(&t, out, x, y, w, h) == (size_t)w * h * channels;
+		for( unsigned int row = 0; ok && row < h; row++ ){
+			ok = memcmp(&out[(size_t)row * w * channels], &image[((size_t)(y + row) * TEST_W + x) * channels], (size_t)w * channels) == 0;
+		}
+		/* A rectangle that sticks out of the image is rejected */
+		ok = ok && qoi_tiled_decompress_rect(&t, out, x, y, TEST_W, h) == 0;
+		qoi_tiled_close(&t);
+	}
+
+	free(container);
+	free(out);
+	return check(ok, "tiled", channels);
+}
+
+
+bool test_frames(const unsigned char *image, unsigned char channels){
+	const size_t size = (size_t)TEST_W * TEST_H * channels;
+	struct qoi_header header = {.w = TEST_W, .h = TEST_H, .channels = channels};
+	unsigned char *next = malloc(size);
+	unsigned char *frames = malloc(qoi_max_frame_size(header) * 2);
+	unsigned char *out = malloc(size);
+	size_t len;
+	size_t read;
+	bool ok;
+
+	memcpy(next, image, size);
+	for( size_t row = 100; row < 120; row++ ){
+		memset(&next[(row * TEST_W + 30) * channels], 0x80, 200 * channels);
+	}
+
+	len = qoi_compress_frame(image, NULL, frames, channels, TEST_W, TEST_H);
+	len += qoi_compress_frame(next, image, &frames[len], channels, TEST_W, TEST_H);
+
+	read = qoi_decompress_frame(frames, out);
+	ok = read != 0 && memcmp(out, image, size) == 0;
+	read += ok ? qoi_decompress_frame(&frames[read], out) : 0;
+	ok = ok && read == len && memcmp(out, next, size) == 0;
+
+	free(next);
+	free(frames);
+	free(out);
+	return check(ok, "frames", channels);
+}
+
+
+/*
+ The second span starts with a run of the last skipped pixel (2, 0, 2), and later on (1, 2, 1) from the first span comes back.
+ Both hash to index 9, so the decoder gets the wrong pixel when the skipped pixel isn't added to the index on both sides.
+ */
+bool test_frame_index(){
+	unsigned char prev[60 * 3];
+	unsigned char next[60 * 3];
+	unsigned char out[60 * 3];
+	unsigned char frames[512];
+	size_t len;
+	size_t read;
+	bool ok;
+
+	memset(prev, 100, sizeof(prev));
+	memcpy(&prev[19 * 3], "\x02\x00\x02", 3);
+	memcpy(next, prev, sizeof(next));
+	for( size_t i = 0; i < 10; i++ ){
+		memcpy(&next[i * 3], "\x01\x02\x01", 3);
+	}
+	memcpy(&next[20 * 3], "\x02\x00\x02", 3);
+	memcpy(&next[21 * 3], "\x32\x3C\x46", 3);
+	memcpy(&next[22 * 3], "\x01\x02\x01", 3);
+
+	len = qoi_compress_frame(prev, NULL, frames, QOI_RGB, 60, 1);
+	len += qoi_compress_frame(next, prev, &frames[len], QOI_RGB, 60, 1);
+
+	read = qoi_decompress_frame(frames, out);
+	read += read != 0 ? qoi_decompress_frame(&frames[read], out) : 0;
+	ok = read == len && memcmp(out, next, sizeof(next)) == 0;
+
+	return check(ok, "frame index", QOI_RGB);
+}
+
+
+/*
+ A 1x1 frame with a changed pixel has the most span overhead per pixel.
+ */
+bool test_frame_size(){
+	const unsigned char prev[4] = {1, 2, 3, 4};
+	const unsigned char next[4] = {200, 100, 50, 25};
+	unsigned char frame[64];
+	struct qoi_header header = {.w = 1, .h = 1, .channels = QOI_RGBA};
+
+	return check(qoi_compress_frame(next, prev, frame, QOI_RGBA, 1, 1) <= qoi_max_frame_size(header), "frame size", QOI_RGBA);
+}
+
+
+bool test_recompress(const unsigned char *image, unsigned char channels){
+	const unsigned int interval = 16;
+	const size_t size = (size_t)TEST_W * TEST_H * channels;
+	struct qoi_header header = {.w = TEST_W, .h = TEST_H, .channels = channels};
+	struct qoi_checkpoint *checkpoints = malloc(((TEST_H + interval - 1) / interval) * sizeof(struct qoi_checkpoint));
+	unsigned char *next = malloc(size);
+	unsigned char *old = malloc(qoi_max_compressed_image_size(header));
+	unsigned char *out = malloc(qoi_max_compressed_image_size(header));
+	unsigned char *expected = malloc(qoi_max_compressed_image_size(header));
+	size_t old_len = qoi_compress_checkpoints(image, old, channels, TEST_W, TEST_H, checkpoints, interval);
+	size_t expected_len;
+	size_t len;
+	bool ok;
+
+	memcpy(next, image, size);
+	memset(&next[(size_t)40 * TEST_W * channels], 0x20, (size_t)11 * TEST_W * channels);
+
+	/* The re-encoded image has to be the same as compressing it from scratch */
+	len = qoi_recompress(next, old, old_len, out, checkpoints, interval, 40, 50);
+	expected_len = qoi_compress(next, expected, channels, TEST_W, TEST_H);
+	ok = len == expected_len && memcmp(out, expected, len) == 0;
+
+	free(checkpoints);
+	free(next);
+	free(old);
+	free(out);
+	free(expected);
+	return check(ok, "recompress", channels);
+}
+
+
+bool test_scaled(const unsigned char *compressed, const unsigned char *image, unsigned char channels){
+	struct qoi_header header = qoi_header_read(compressed);
+	bool ok = true;
+
+	for( unsigned int shift = 1; shift <= 3; shift++ ){
+		const size_t scaled_w = (TEST_W + (1u << shift) - 1) >> shift;
+		const size_t scaled_h = (TEST_H + (1u << shift) - 1) >> shift;
+		unsigned char *out = malloc(qoi_scaled_image_size(header, shift));
+
+		ok = ok && qoi_decompress_scaled(compressed, out, shift) == scaled_w * scaled_h * channels;
+
+		/* Every output pixel is the rounded average of its block, blocks at the right and bottom edge are smaller */
+		for( size_t y = 0; ok && y < scaled_h; y++ ){
+			for( size_t x = 0; ok && x < scaled_w; x++ ){
+				for( size_t c = 0; c < channels; c++ ){
+					unsigned int sum = 0, count = 0;
+					for( size_t yy = y << shift; yy < ((y + 1) << shift) && yy < TEST_H; yy++ ){
+						for( size_t xx = x << shift; xx < ((x + 1) << shift) && xx < TEST_W; xx++ ){
+							sum += image[(yy * TEST_W + xx) * channels + c];
+							count += 1;
+						}
+					}
+					ok = ok && out[(y * scaled_w + x) * channels + c] == (sum + count / 2) / count;
+				}
+			}
+		}
+		free(out);
+	}
+
+	return check(ok, "scaled", channels);
+}
+
+
+bool test_hashed(const unsigned char *compressed, size_t len, const unsigned char *image, unsigned char channels){
+	/* XXH64 of make_image(13, 7, channels, 5) and of its QOI image, from the reference xxHash implementation */
+	const uint64_t known_pixels[2] = {0xD3F17C9B204F8A69ULL, 0x1535150B9925DA86ULL};
+	const uint64_t known_compressed[2] = {0x65F36FAEE4C4FE75ULL, 0x85311B0A185920A2ULL};
+	struct qoi_header header = qoi_header_read(compressed);
+	unsigned char *out = malloc(qoi_max_compressed_image_size(header));
+	unsigned char *pixels = malloc(qoi_decompressed_image_size(header));
+	unsigned char *known = make_image(13, 7, channels, 5);
+	struct qoi_hashes compress_hashes;
+	struct qoi_hashes decompress_hashes;
+	bool ok;
+
+	ok = qoi_compress_hashed(image, out, channels, TEST_W, TEST_H, &compress_hashes) == len && memcmp(out, compressed, len) == 0;
+	ok = ok && qoi_decompress_hashed(compressed, pixels, &decompress_hashes) == qoi_decompressed_image_size(header);
+	ok = ok && memcmp(pixels, image, qoi_decompressed_image_size(header)) == 0
+		&& compress_hashes.pixels == decompress_hashes.pixels && compress_hashes.compressed == decompress_hashes.compressed;
+
+	ok = ok && qoi_compress_hashed(known, out, channels, 13, 7, &compress_hashes) != 0
+		&& compress_hashes.pixels == known_pixels[channels - 3] && compress_hashes.compressed == known_compressed[channels - 3];
+
+	free(out);
+	free(pixels);
+	free(known);
+	return check(ok, "hashed", channels);
+}
+
+
+bool test_inplace(const unsigned char *compressed, size_t len, const unsigned char *image, unsigned char channels){
+	const size_t buf_size = qoi_inplace_buffer_size(compressed, len);
+	/* 0x80000000 * 0x80000000 pixels, the decoded size doesn't fit in a size_t */
+	const unsigned char huge[22] = {'q', 'o', 'i', 'f', 0x80, 0, 0, 0, 0x80, 0, 0, 0, QOI_RGBA, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+	unsigned char *buf = malloc(buf_size);
+	unsigned char small[64];
+	bool ok = buf_size != 0;
+
+	if( ok ){
+		memcpy(&buf[buf_size - len], compressed, len);
+		ok = qoi_decompress_inplace(buf, buf_size, len) == (size_t)TEST_W * TEST_H * channels
+			&& memcmp(buf, image, (size_t)TEST_W * TEST_H * channels) == 0;
+	}
+
+	memcpy(&small[sizeof(small) - sizeof(huge)], huge, sizeof(huge));
+	ok = ok && qoi_inplace_buffer_size(huge, sizeof(huge)) == 0 && qoi_decompress_inplace(small, sizeof(small), sizeof(huge)) == 0;
+
+	free(buf);
+	return check(ok, "inplace", channels);
+}
+
+
+bool test_archive(const unsigned char *image, unsigned char channels){
+	const char *path = "test_archive.qoia";
+	unsigned char *small = make_image(37, 21, QOI_RGBA, 7);
+	struct qoi_archive_entry entries[3] = {
+		{.name = "image", .pixels = image, .w = TEST_W, .h = TEST_H, .channels = channels},
+		{.name = "small", .pixels = small, .w = 37, .h = 21, .channels = QOI_RGBA},
+		{.name = "invalid", .pixels = small, .w = 37, .h = 21, .channels = 5}
+	};
+	unsigned char *out = malloc((size_t)TEST_W * TEST_H * channels);
+	struct qoi_archive ar;
+	bool ok;
+
+	/* An entry that can't be compressed fails the whole archive, with any amount of threads */
+	ok = !qoi_archive_pack(path, entries, 3, 8);
+	ok = ok && qoi_archive_pack(path, entries, 2, 8) && qoi_archive_open(&ar, path);
+
+	if( ok ){
+		ok = qoi_archive_decompress(&ar, "image", out) == (size_t)TEST_W * TEST_H * channels
+			&& memcmp(out, image, (size_t)TEST_W * TEST_H * channels) == 0;
+		ok = ok && qoi_archive_decompress(&ar, "small", out) == 37 * 21 * QOI_RGBA && memcmp(out, small, 37 * 21 * QOI_RGBA) == 0;
+		ok = ok && qoi_archive_find(&ar, "missing", NULL) == NULL;
+		qoi_archive_close(&ar);
+	}
+	remove(path);
+
+	free(small);
+	free(out);
+	return check(ok, "archive", channels);
+}
+
+
+bool test_planar(const unsigned char *compressed, size_t len, const unsigned char *image, unsigned char channels){
+	const size_t stride = TEST_W + 3;
+	struct qoi_header header = qoi_header_read(compressed);
+	unsigned char *planes[4];
+	size_t strides[4];
+	unsigned char *out = malloc(qoi_max_compressed_image_size(header));
+	bool ok;
+
+	for( size_t c = 0; c < channels; c++ ){
+		planes[c] = malloc(stride * TEST_H);
+		strides[c] = stride;
+	}
+
+	ok = qoi_decompress_planar(compressed, planes, strides) == (size_t)TEST_W * TEST_H * channels;
+	for( size_t i = 0; ok && i < (size_t)TEST_W * TEST_H; i++ ){
+		for( size_t c = 0; c < channels; c++ ){
+			ok = ok && planes[c][(i / TEST_W) * stride + i % TEST_W] == image[i * channels + c];
+		}
+	}
+	ok = ok && qoi_compress_planar((const unsigned char *const *)planes, strides, out, channels, TEST_W, TEST_H) == len
+		&& memcmp(out, compressed, len) == 0;
+
+	for( size_t c = 0; c < channels; c++ ){
+		free(planes[c]);
+	}
+	free(out);
+	return check(ok, "planar", channels);
+}
+
+
+bool test_nontemporal(const unsigned char *compressed, const unsigned char *image, unsigned char channels){
+	const size_t size = (size_t)TEST_W * TEST_H * channels;
+	unsigned char *out = qoi_alloc(size + 1, QOI_ALLOC_TRANSPARENT_HUGEPAGES);
+	bool ok = out != NULL;
+
+	/* Start at an unaligned address, so the stores up to the first aligned one are checked as well */
+	ok = ok && qoi_decompress_nontemporal(compressed, out + 1) == size && memcmp(out + 1, image, size) == 0;
+
+	if( out != NULL ){
+		qoi_free(out, size + 1);
+	}
+	return check(ok, "nontemporal", channels);
+}
+
+
+bool test_sizes(){
+	struct qoi_header huge = {.w = 0x80000000u, .h = 0x80000000u, .channels = QOI_RGBA};
+	struct qoi_header big = {.w = 100000, .h = 100000, .channels = QOI_RGBA};
+	bool ok;
+
+	memcpy(huge.magic, "qoif", 4);
+	memcpy(big.magic, "qoif", 4);
+
+	ok = qoi_max_compressed_image_size(huge) == 0 && qoi_decompressed_image_size(huge) == 0;
+	ok = ok && qoi_decompressed_image_size(big) == (size_t)100000 * 100000 * 4
+		&& qoi_max_compressed_image_size(big) == (size_t)100000 * 100000 * 5 + 14 + 8;
+
+	return check(ok, "sizes", QOI_RGBA);
+}
+
+
+/*
+ With every alpha at 255 an RGB image has to give the same ops as the RGBA one, for every width around the 16 pixel blocks.
+ */
+bool test_rgb(){
+	unsigned char *rgb = make_image(40, 3, QOI_RGB, 3);
+	unsigned char *rgba = malloc(40 * 3 * 4);
+	unsigned char *out_rgb = malloc(40 * 3 * 5 + 14 + 8);
+	unsigned char *out_rgba = malloc(40 * 3 * 5 + 14 + 8);
+	unsigned char *pixels = malloc(40 * 3 * 4);
+	size_t len;
+	bool ok = true;
+
+	for( unsigned int w = 1; ok && w <= 40; w++ ){
+		for( size_t i = 0; i < (size_t)w * 3; i++ ){
+			memcpy(&rgba[i * 4], &rgb[i * 3], 3);
+			rgba[i * 4 + 3] = 255;
+		}
+
+		len = qoi_compress(rgb, out_rgb, QOI_RGB, w, 3);
+		ok = len == qoi_compress(rgba, out_rgba, QOI_RGBA, w, 3) && memcmp(&out_rgb[14], &out_rgba[14], len - 14) == 0;
+		ok = ok && qoi_decompress(out_rgb, pixels) == (size_t)w * 3 * 3 && memcmp(pixels, rgb, (size_t)w * 3 * 3) == 0;
+	}
+
+	free(rgb);
+	free(rgba);
+	free(out_rgb);
+	free(out_rgba);
+	free(pixels);
+	return check(ok, "rgb", QOI_RGB);
+}
+
+
+bool test_validate(const unsigned char *compressed, size_t len, unsigned char channels){
+	struct qoi_info info;
+	struct qoi_op_stats stats;
+	bool ok;
+
+	ok = qoi_validate(compressed, len, &info) && info.size == len && info.pixel_count == (size_t)TEST_W * TEST_H;
+	ok = ok && qoi_validate_stats(compressed, len, &info, &stats)
+		&& stats.index + stats.diff + stats.luma + stats.rgb + stats.rgba + stats.run_pixels == info.pixel_count;
+	/* Cut off in the end marker and in the middle of the ops */
+	ok = ok && !qoi_validate(compressed, len - 1, NULL) && !qoi_validate(compressed, len / 2, NULL);
+
+	return check(ok, "validate", channels);
+}
+
+
+bool test_stream(const unsigned char *compressed, size_t len, const unsigned char *image, unsigned char channels){
+	const size_t pixel_count = (size_t)TEST_W * TEST_H;
+	const size_t chunks[] = {1, 7, 100, 4096};
+	unsigned char *out = malloc(pixel_count * (channels + 1) + 14 + 8);
+	unsigned char *pixels = malloc(pixel_count * channels);
+	struct qoi_stream s;
+	size_t out_len;
+	size_t pixel_counter = 0;
+	size_t in_index;
+	size_t decoded;
+	size_t n;
+	bool ok;
+
+	out_len = qoi_stream_encode_begin(&s, out, channels, TEST_W, TEST_H);
+	for( size_t i = 0; pixel_counter < pixel_count; i++ ){
+		n = chunks[i % 4] < pixel_count - pixel_counter ? chunks[i % 4] : pixel_count - pixel_counter;
+		out_len += qoi_stream_encode(&s, &image[pixel_counter * channels], n, &out[out_len]);
+		pixel_counter += n;
+	}
+	out_len += qoi_stream_encode_end(&s, &out[out_len]);
+	ok = out_len == len && memcmp(out, compressed, len) == 0;
+
+	/* Hand the input over a few bytes at a time, so ops get cut off at the end of it */
+	in_index = qoi_stream_decode_begin(&s, compressed, 14);
+	pixel_counter = 0;
+	for( size_t i = 0; ok && pixel_counter < pixel_count; i++ ){
+		n = len - in_index < 3 + i % 5 ? len - in_index : 3 + i % 5;
+		in_index += qoi_stream_decode(&s, &compressed[in_index], n, &pixels[pixel_counter * channels], chunks[i % 4], &decoded);
+		pixel_counter += decoded;
+		ok = in_index < len;
+	}
+	ok = ok && qoi_stream_decode_end(&s, &compressed[in_index], len - in_index) == 8 && memcmp(pixels, image, pixel_count * channels) == 0;
+	ok = ok && qoi_stream_decode(&s, compressed, len, NULL, 1, &decoded) == 0;
+
+	free(out);
+	free(pixels);
+	return check(ok, "stream", channels);
+}
+
+
+bool test_api(){
+	bool ok = true;
+
+	for( unsigned char channels = QOI_RGB; channels <= QOI_RGBA; channels++ ){
+		unsigned char *image = make_image(TEST_W, TEST_H, channels, channels);
+		struct qoi_header header = {.w = TEST_W, .h = TEST_H, .channels = channels};
+		unsigned char *compressed = malloc(qoi_max_compressed_image_size(header));
+		unsigned char *pixels = malloc((size_t)TEST_W * TEST_H * channels);
+		size_t len = qoi_compress(image, compressed, channels, TEST_W, TEST_H);
+
+		ok &= check(len != 0 && qoi_decompress(compressed, pixels) == (size_t)TEST_W * TEST_H * channels
+			&& memcmp(pixels, image, (size_t)TEST_W * TEST_H * channels) == 0, "roundtrip", channels);
+		ok &= check(qoi_compressed_size(compressed, len) == len && qoi_compressed_size(compressed, len - 1) == 0, "compressed size", channels);
+		ok &= test_tiled(image, channels);
+		ok &= test_frames(image, channels);
+		ok &= test_recompress(image, channels);
+		ok &= test_scaled(compressed, image, channels);
+		ok &= test_hashed(compressed, len, image, channels);
+		ok &= test_inplace(compressed, len, image, channels);
+		ok &= test_archive(image, channels);
+		ok &= test_planar(compressed, len, image, channels);
+		ok &= test_nontemporal(compressed, image, channels);
+		ok &= test_validate(compressed, len, channels);
+		ok &= test_stream(compressed, len, image, channels);
+
+		free(image);
+		free(compressed);
+		free(pixels);
+	}
+
+	ok &= test_frame_index();
+	ok &= test_frame_size();
+	ok &= test_sizes();
+	ok &= test_rgb();
+
+	fprintf(stderr, ok ? "API tests passed\n\n" : "API tests FAILED\n\n");
+	return ok;
+}
+
+
 #define IMAGES 3
 int main(){
     int i = 0;
@@ -236,6 +710,10 @@ int main(){
     const char* foutname[] = {"Frieren.qoi", "rgba_big.qoi", "forest.qoi"};
     const char* foutdecompressedname[] = {"Frieren_d.rgba", "rgba_big_d.rgba", "forest_d.rgb"};
 
+    if( !test_api() ){
+        return -1;
+    }
+
     for( image_counter = 0; image_counter < IMAGES; image_counter++ ){
         time_total = 0.0;
         min = DBL_MAX;